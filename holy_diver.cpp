@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <string.h>
+#include <stdint.h>
 #include <iostream>
 #include <cstdlib>
 #include <ctime>
@@ -10,20 +12,79 @@
 #include <errno.h>
 #include <cctype>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <fstream>
+#include <climits>
 #include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <new>
+#include <type_traits>
+#include <stdexcept>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/timerfd.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 using namespace std;
 
 /****************************************************/
 // Constants
 /****************************************************/
-const int MAP_WIDTH = 20;
-const int MAP_HEIGHT = 20;
+const int DEFAULT_MAP_WIDTH = 20;
+const int DEFAULT_MAP_HEIGHT = 20;
+const int VIEW_WIDTH = 60;   // Largest slice of the map drawn around the player
+const int VIEW_HEIGHT = 20;
+const int SPARSE_INDEX_RATIO = 64;   // Tiles per entity above which TileIndex hashes
+const int CHUNK_SIZE = 64;           // Streamed maps page tiles in 64x64 chunks
+const int DEFAULT_CHUNK_BUDGET = 64; // Chunks kept resident while streaming
+const int MIN_CHUNK_BUDGET = 16;     // Enough for the viewport plus neighbours
 const int MAX_HEALTH = 100;
 const int MAX_OXYGEN = 100;
 const int MAX_BATTERY = 100;
 const int BATTERY_COST = 5;
+const int SIGHT_RANGE = 3;           // Enemies closer than this can be spotted
+const int ENEMY_TICK_MS = 400;       // Enemies move on this fixed period
+const int MAX_CATCHUP_TICKS = 5;     // Ticks replayed at most after a stall
+const int PLAYER_TICK_MS = 100;      // The diver acts at most this often
+const int ACTION_QUEUE_SIZE = 4;     // Queued actions past this drop the oldest
+const int INPUT_READ_SIZE = 256;     // Bytes taken from the terminal per read()
+const int ENEMY_CHUNK = 4096;        // Enemies per unit of parallel work
+const int PARALLEL_ENEMY_MIN = 32768;  // Smaller batches update on one thread
+const int FLOW_FIELD_SIZE = 128;     // Side of the chase window around the diver
+const uint8_t FLOW_UNREACHED = 255;  // Farther than 254 steps, walled off or outside
+const int FOV_RADIUS = 8;            // How far the diver sees past open water
+const int MAX_FOV_RADIUS = 31;       // A field of view row fits in 64 bits
+
+const int PLAN_WINDOW = 32;          // Side of the square the autopilot plans in
+const int PLAN_DEPTH = 10;           // Actions looked ahead per decision
+const int PLAN_BEAM = 64;            // Best lines kept at each depth
+const int PLAN_MAX_ITEMS = 64;       // Collectibles the plan tracks, one bit each
+const int PLAN_IDLE_COST = 32;       // Value lost per action that changes nothing
+const int PLAN_GOAL_STEP = 24;       // Value of each step nearer the goal
+const int PLAN_GOAL_PATIENCE = 64;   // Decisions without getting nearer before a goal is dropped
+const int PLAN_LOW_OXYGEN = 40;      // Below this the goal is the nearest oxygen tank
+
+static_assert(SIGHT_RANGE <= FOV_RADIUS, "enemies are spotted inside the field of view");
+static_assert(FOV_RADIUS <= MAX_FOV_RADIUS, "field of view rows are 64-bit masks");
+static_assert(PLAN_DEPTH + 1 < PLAN_WINDOW / 2, "a plan never reaches the window's edge");
 
 // Coin and collectible types
 const char COIN = '*';
@@ -34,7 +95,7 @@ const char OXYGEN_TANK = 'O';
 // Forward declarations
 /****************************************************/
 class World;
-class Enemy;
+class Screen;
 
 /****************************************************/
 // Player Class
@@ -54,6 +115,10 @@ public:
                                       battery(MAX_BATTERY),
                                       lives(3) {}
 
+    // Resumes a diver with saved stats
+    Player(int startX, int startY, int hp, int air, int charge, int livesLeft)
+        : x(startX), y(startY), health(hp), oxygen(air), battery(charge), lives(livesLeft) {}
+
     int getX() const { return x; }
     int getY() const { return y; }
     int getHealth() const { return health; }
@@ -97,477 +162,4114 @@ public:
 };
 
 /****************************************************/
-// Enemy Base Class
+// Random Numbers
 /****************************************************/
-class Enemy {
-protected:
-    int x, y;
-    int damage;
-    bool active;
-    bool visible;
+// xoshiro256** seeded through splitmix64. A World keeps one generator per
+// purpose, so an extra roll while building the map never shifts how the
+// enemies move, and one seed always replays the same game bit for bit.
+enum RngStream { RNG_MAP, RNG_SPAWN, RNG_AI, RNG_POLICY };
+const int WORLD_RNG_STREAMS = 3;  // The policy stream belongs to the driver
+
+class Rng {
+private:
+    uint64_t s[4];
+
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
 
 public:
-    Enemy(int startX, int startY, int dmg) : x(startX), y(startY), 
-                                               damage(dmg), 
-                                               active(false),
-                                               visible(false) {}
-    
-    virtual ~Enemy() {}
+    Rng() { seed(0, 0); }
 
-    int getX() const { return x; }
-    int getY() const { return y; }
-    int getDamage() const { return damage; }
-    bool isActive() const { return active; }
-    bool isVisible() const { return visible; }
+    // Expands (seed, stream) into a full state, so streams of one seed are
+    // unrelated and none starts all-zero
+    void seed(uint64_t value, int stream) {
+        uint64_t z = value ^ (0xD1B54A32D192ED03ULL * (uint64_t)(stream + 1));
+        for (int i = 0; i < 4; i++) {
+            z += 0x9E3779B97F4A7C15ULL;
+            uint64_t x = z;
+            x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+            s[i] = x ^ (x >> 31);
+        }
+    }
 
-    void activate() { active = true; }
-    void makeVisible() { visible = true; }
-    
-    virtual void move(World* world) = 0;  // Pure virtual for polymorphism
-    
-    int giveDamage() const { return damage; }
+    uint64_t next() {
+        uint64_t result = rotl(s[1] * 5, 7) * 9;
+        uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    // Uniform in [0, n) by multiply-shift, no division
+    int below(int n) { return (int)(((next() >> 32) * (uint64_t)n) >> 32); }
+
+    void save(uint64_t out[4]) const { memcpy(out, s, sizeof(s)); }
+    void load(const uint64_t in[4]) { memcpy(s, in, sizeof(s)); }
 };
 
 /****************************************************/
-// Stationary Enemy Class
+// Enemy Store
 /****************************************************/
-class StationaryEnemy : public Enemy {
-public:
-    StationaryEnemy(int startX, int startY) : Enemy(startX, startY, 20) {}
-    
-    void move(World* world) override {
-        // Stationary enemies don't move
+// Enemies are plain data kept in one batch of parallel arrays per behaviour,
+// so a tick walks contiguous memory with no per-enemy allocation or virtual
+// dispatch. Stationary enemies never move; moving ones wander once alerted.
+enum EnemyKind { STATIONARY_ENEMY, MOVING_ENEMY, ENEMY_KIND_COUNT };
+const int ENEMY_DAMAGE[ENEMY_KIND_COUNT] = { 20, 15 };
+
+struct EnemyBatch {
+    vector<int> x, y;
+    vector<int> damage;
+    vector<unsigned char> active;
+    vector<unsigned char> visible;
+
+    int size() const { return x.size(); }
+
+    void add(int startX, int startY, int dmg) {
+        x.push_back(startX);
+        y.push_back(startY);
+        damage.push_back(dmg);
+        active.push_back(0);
+        visible.push_back(0);
+    }
+
+    // Replaces the batch with n dormant enemies copied from packed arrays
+    void assign(const int32_t* xs, const int32_t* ys, const int32_t* dmg, int n) {
+        x.assign(xs, xs + n);
+        y.assign(ys, ys + n);
+        damage.assign(dmg, dmg + n);
+        active.assign(n, 0);
+        visible.assign(n, 0);
+    }
+
+    void clear() {
+        x.clear();
+        y.clear();
+        damage.clear();
+        active.clear();
+        visible.clear();
     }
 };
 
-/****************************************************/
-// Moving Enemy Class
-/****************************************************/
-class MovingEnemy : public Enemy {
+// Enemy ids number the batches one after another in kind order
+class EnemyStore {
+private:
+    EnemyBatch batches[ENEMY_KIND_COUNT];
+    int base[ENEMY_KIND_COUNT + 1];
+
 public:
-    MovingEnemy(int startX, int startY) : Enemy(startX, startY, 15) {}
-    
-    void move(World* world) override;  // Defined after World class
+    EnemyStore() { clear(); }
+
+    void add(EnemyKind kind, int x, int y) {
+        batches[kind].add(x, y, ENEMY_DAMAGE[kind]);
+    }
+
+    void clear() {
+        for (int k = 0; k < ENEMY_KIND_COUNT; k++) batches[k].clear();
+        renumber();
+    }
+
+    // Fixes the id ranges; call once every enemy has been added
+    void renumber() {
+        base[0] = 0;
+        for (int k = 0; k < ENEMY_KIND_COUNT; k++) base[k + 1] = base[k] + batches[k].size();
+    }
+
+    int size() const { return base[ENEMY_KIND_COUNT]; }
+    EnemyBatch& batch(int kind) { return batches[kind]; }
+    const EnemyBatch& batch(int kind) const { return batches[kind]; }
+    int id(int kind, int i) const { return base[kind] + i; }
+
+    // Splits an id into its kind and position within that batch
+    int locate(int id, int& i) const {
+        int k = ENEMY_KIND_COUNT - 1;
+        while (id < base[k]) k--;
+        i = id - base[k];
+        return k;
+    }
 };
 
 /****************************************************/
-// World Class
+// Profiler
 /****************************************************/
-class World {
-private:
-    char map[MAP_HEIGHT][MAP_WIDTH];
-    bool illuminated[MAP_HEIGHT][MAP_WIDTH];
-    Player* player;
-    vector<Enemy*> enemies;
-    int score;
-    
-    struct Collectible {
-        int x, y;
-        char type;
-        bool collected;
-    };
-    vector<Collectible> collectibles;
+// Scoped timers around the work of a frame and counters for how much of it
+// there was. Each timer keeps a log2 histogram of its durations that is
+// halved every PROFILE_WINDOW samples, so p50 and p99 follow the recent
+// frames. Probes read the TSC on x86, converted to time only when the
+// profile is shown. Build with -DHOLY_DIVER_PROFILE=0 to compile every
+// probe out; built in, a probe on a disabled profiler is one branch. The
+// probes sit on the main thread only; worker threads are never timed.
+#ifndef HOLY_DIVER_PROFILE
+#define HOLY_DIVER_PROFILE 1
+#endif
 
-public:
-    World() : player(nullptr), score(0) {
-        // Initialize illumination map
-        for (int y = 0; y < MAP_HEIGHT; y++) {
-            for (int x = 0; x < MAP_WIDTH; x++) {
-                illuminated[y][x] = false;
-            }
-        }
-    }
-
-    ~World() {
-        if (player) delete player;
-        for (Enemy* e : enemies) delete e;
-    }
-
-    void loadMap(const string& filepath) {
-        ifstream file(filepath);
-        if (file.is_open()) {
-            for (int y = 0; y < MAP_HEIGHT; y++) {
-                for (int x = 0; x < MAP_WIDTH; x++) {
-                    char c;
-                    if (file.get(c)) {
-                        if (c == '\n') file.get(c);  // skip newlines
-                        
-                        if (c == 'P') {
-                            player = new Player(x, y);
-                            map[y][x] = 'o';
-                            illuminated[y][x] = true;  // Start position visible
-                        } else if (c == 'M') {
-                            // Randomly create stationary or moving enemy
-                            if (rand() % 2 == 0) {
-                                enemies.push_back(new StationaryEnemy(x, y));
-                            } else {
-                                enemies.push_back(new MovingEnemy(x, y));
-                            }
-                            map[y][x] = 'o';
-                        } else {
-                            map[y][x] = c;
-                        }
-                    }
-                }
-            }
-            file.close();
-        } else {
-            // Default map if file not found
-            createDefaultMap();
+long long monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+inline long long profile_ticks() { return __rdtsc(); }
+#else
+inline long long profile_ticks() { return monotonic_ns(); }
+#endif
+
+enum ProfileTimer { PROF_INPUT, PROF_UPDATE_ENEMIES, PROF_REQUEST_MOVE, PROF_ILLUMINATE, PROF_RENDER,
+                    PROF_TIMER_COUNT };
+const char* const PROFILE_TIMER_NAMES[PROF_TIMER_COUNT] = {
+    "input", "updateEnemies", "requestMove", "illuminateTile", "render"
+};
+enum ProfileCounter { PROF_ENEMIES_SCANNED, PROF_TILES_DRAWN, PROF_BYTES_WRITTEN, PROF_COUNTER_COUNT };
+const char* const PROFILE_COUNTER_NAMES[PROF_COUNTER_COUNT] = {
+    "enemies scanned", "tiles drawn", "bytes written"
+};
+const uint32_t PROFILE_WINDOW = 4096;  // Samples between halvings of a histogram
+
+struct ProfileHistogram {
+    uint32_t buckets[64];   // Bucket b holds durations in [2^b, 2^(b+1)) ticks
+    uint32_t recent;        // Samples still weighing in full
+    long long calls, totalTicks, maxTicks;
+
+    void add(long long ticks) {
+        buckets[ticks > 1 ? 63 - __builtin_clzll(ticks) : 0]++;
+        calls++;
+        totalTicks += ticks;
+        if (ticks > maxTicks) maxTicks = ticks;
+        if (++recent == PROFILE_WINDOW) {
+            for (int b = 0; b < 64; b++) buckets[b] >>= 1;
+            recent = PROFILE_WINDOW / 2;
         }
     }
 
-    void createDefaultMap() {
-        // Fill with walls on edges, empty inside
-        for (int y = 0; y < MAP_HEIGHT; y++) {
-            for (int x = 0; x < MAP_WIDTH; x++) {
-                if (y == 0 || y == MAP_HEIGHT - 1 || x == 0 || x == MAP_WIDTH - 1) {
-                    map[y][x] = 'x';
-                } else {
-                    map[y][x] = 'o';
-                }
+    // In ticks, interpolated inside the bucket the percentile falls in
+    double percentile(double p) const {
+        uint64_t total = 0;
+        for (int b = 0; b < 64; b++) total += buckets[b];
+        if (total == 0) return 0.0;
+        double target = p * total, before = 0.0;
+        for (int b = 0; b < 64; b++) {
+            if (buckets[b] == 0) continue;
+            if (before + buckets[b] >= target) {
+                double low = b == 0 ? 0.0 : (double)(1ULL << b);
+                return min((double)maxTicks, low + (double)(1ULL << b) * (target - before) / buckets[b]);
             }
+            before += buckets[b];
         }
-        
-        // Add more obstacles for interesting layout
-        for (int i = 0; i < 25; i++) {
-            int x = 2 + rand() % (MAP_WIDTH - 4);
-            int y = 2 + rand() % (MAP_HEIGHT - 4);
-            map[y][x] = 'x';
-        }
+        return (double)maxTicks;
+    }
+};
 
-        // Create player
-        player = new Player(5, 5);
-        illuminated[5][5] = true;
+class Profiler {
+private:
+    bool enabled;
+    ProfileHistogram timers[PROF_TIMER_COUNT];
+    long long counters[PROF_COUNTER_COUNT];
+    long long startNs, startTicks;
+    // Counter rates over the last second, for the overlay
+    long long rollNs;
+    long long rolledCounters[PROF_COUNTER_COUNT];
+    double rates[PROF_COUNTER_COUNT];
 
-        // Add many more enemies (mix of stationary and moving)
-        for (int i = 0; i < 15; i++) {
-            int x = 2 + rand() % (MAP_WIDTH - 4);
-            int y = 2 + rand() % (MAP_HEIGHT - 4);
-            if (map[y][x] == 'o' && !(x == 5 && y == 5)) {
-                if (rand() % 3 == 0) {  // 1/3 chance stationary
-                    enemies.push_back(new StationaryEnemy(x, y));
-                } else {
-                    enemies.push_back(new MovingEnemy(x, y));
-                }
-            }
-        }
-        
-        // Spawn collectibles (coins, battery packs, oxygen tanks)
-        spawnCollectibles();
+    static string formatNs(double ns) {
+        char buf[32];
+        if (ns < 1e3) snprintf(buf, sizeof(buf), "%.0fns", ns);
+        else if (ns < 1e6) snprintf(buf, sizeof(buf), "%.1fus", ns / 1e3);
+        else snprintf(buf, sizeof(buf), "%.1fms", ns / 1e6);
+        return buf;
     }
 
-    void spawnCollectibles() {
-        // Spawn 10-15 coins
-        for (int i = 0; i < 10 + rand() % 6; i++) {
-            int x = 1 + rand() % (MAP_WIDTH - 2);
-            int y = 1 + rand() % (MAP_HEIGHT - 2);
-            if (map[y][x] == 'o') {
-                collectibles.push_back({x, y, COIN, false});
-            }
+    // Measured over the whole run so far, so no calibration pause is needed
+    double nsPerTick() const {
+        long long ticks = profile_ticks() - startTicks;
+        return ticks > 0 ? (double)(monotonic_ns() - startNs) / ticks : 1.0;
+    }
+
+public:
+    Profiler() : enabled(false) { clear(); }
+
+    void clear() {
+        memset(timers, 0, sizeof(timers));
+        memset(counters, 0, sizeof(counters));
+        memset(rolledCounters, 0, sizeof(rolledCounters));
+        memset(rates, 0, sizeof(rates));
+        startNs = rollNs = monotonic_ns();
+        startTicks = profile_ticks();
+    }
+
+    // Stays off when the probes are compiled out
+    void enable(bool on) { enabled = on && HOLY_DIVER_PROFILE; }
+    bool isEnabled() const { return enabled; }
+
+    void record(ProfileTimer timer, long long ticks) { timers[timer].add(ticks); }
+
+    void count(ProfileCounter counter, long long n) {
+        if (enabled) counters[counter] += n;
+    }
+
+    // Draws the overlay into the top-right corner of the frame, from `row` down
+    void draw(Screen& screen, int row);
+
+    // Writes the whole profile as a text table; false if the file cannot
+    // be written
+    bool dump(const string& path, string& error) const {
+        ofstream out(path.c_str());
+        if (!out) {
+            error = path + ": cannot write profile";
+            return false;
         }
-        
-        // Spawn 3-5 battery packs
-        for (int i = 0; i < 3 + rand() % 3; i++) {
-            int x = 1 + rand() % (MAP_WIDTH - 2);
-            int y = 1 + rand() % (MAP_HEIGHT - 2);
-            if (map[y][x] == 'o') {
-                collectibles.push_back({x, y, BATTERY_PACK, false});
-            }
+        char line[160];
+        double seconds = (monotonic_ns() - startNs) / 1e9;
+        double scale = nsPerTick();
+        snprintf(line, sizeof(line), "# holy_diver profile over %.1f s\n", seconds);
+        out << line;
+        snprintf(line, sizeof(line), "%-16s %10s %10s %10s %10s %10s\n", "timer", "calls", "mean", "p50", "p99",
+                 "max");
+        out << line;
+        for (int t = 0; t < PROF_TIMER_COUNT; t++) {
+            const ProfileHistogram& h = timers[t];
+            snprintf(line, sizeof(line), "%-16s %10lld %10s %10s %10s %10s\n", PROFILE_TIMER_NAMES[t], h.calls,
+                     formatNs(h.calls ? scale * h.totalTicks / h.calls : 0.0).c_str(),
+                     formatNs(scale * h.percentile(0.5)).c_str(), formatNs(scale * h.percentile(0.99)).c_str(),
+                     formatNs(scale * h.maxTicks).c_str());
+            out << line;
         }
-        
-        // Spawn 3-5 oxygen tanks
-        for (int i = 0; i < 3 + rand() % 3; i++) {
-            int x = 1 + rand() % (MAP_WIDTH - 2);
-            int y = 1 + rand() % (MAP_HEIGHT - 2);
-            if (map[y][x] == 'o') {
-                collectibles.push_back({x, y, OXYGEN_TANK, false});
-            }
+        snprintf(line, sizeof(line), "%-16s %10s %10s\n", "counter", "total", "per sec");
+        out << line;
+        for (int c = 0; c < PROF_COUNTER_COUNT; c++) {
+            snprintf(line, sizeof(line), "%-16s %10lld %10.0f\n", PROFILE_COUNTER_NAMES[c], counters[c],
+                     seconds > 0 ? counters[c] / seconds : 0.0);
+            out << line;
         }
+        if (!out.flush()) {
+            error = path + ": cannot write profile";
+            return false;
+        }
+        return true;
     }
+};
 
-    bool canMoveTo(int x, int y) const {
-        if (x < 0 || x >= MAP_WIDTH || y < 0 || y >= MAP_HEIGHT) return false;
-        return map[y][x] != 'x';
+Profiler profiler;
+
+// Times the enclosing scope into one of the profiler's timers
+class ProfileScope {
+private:
+    ProfileTimer timer;
+    long long start;
+
+public:
+    explicit ProfileScope(ProfileTimer t) : timer(t), start(profiler.isEnabled() ? profile_ticks() : 0) {}
+    ~ProfileScope() {
+        if (start) profiler.record(timer, profile_ticks() - start);
     }
+};
 
-    bool requestMove(int fromX, int fromY, int toX, int toY, bool isPlayer) {
-        if (!canMoveTo(toX, toY)) {
-            if (isPlayer) {
-                player->consumeOxygen(2);  // Consume oxygen even on failed move
-            }
-            return false;
-        }
+#if HOLY_DIVER_PROFILE
+#define PROFILE_JOIN2(a, b) a##b
+#define PROFILE_JOIN(a, b) PROFILE_JOIN2(a, b)
+#define PROFILE_SCOPE(timer) ProfileScope PROFILE_JOIN(profileScope, __LINE__)(timer)
+#define PROFILE_COUNT(counter, n) profiler.count(counter, n)
+#else
+#define PROFILE_SCOPE(timer) ((void)0)
+#define PROFILE_COUNT(counter, n) ((void)sizeof(n))
+#endif
 
-        if (isPlayer) {
-            // Check for enemy collision
-            for (Enemy* enemy : enemies) {
-                if (enemy->getX() == toX && enemy->getY() == toY) {
-                    player->takeDamage(enemy->giveDamage());
-                    return false;  // Can't move into enemy
-                }
-            }
-            player->setPosition(toX, toY);
-            player->consumeOxygen(2);
-            
-            // Illuminate current position
-            illuminated[toY][toX] = true;
-            
-            // Check for collectibles
-            for (auto& col : collectibles) {
-                if (!col.collected && col.x == toX && col.y == toY) {
-                    col.collected = true;
-                    if (col.type == COIN) {
-                        score += 50;
-                    } else if (col.type == BATTERY_PACK) {
-                        player->rechargeBattery(30);
-                        score += 20;
-                    } else if (col.type == OXYGEN_TANK) {
-                        player->addOxygen(40);
-                        score += 20;
-                    }
-                }
-            }
-        }
+/****************************************************/
+// Screen Class
+/****************************************************/
+// Double-buffered character frame. A frame is composed into the back buffer,
+// compared against what the terminal already shows, and only the changed
+// cells are sent, with cursor addressing, in a single write().
+class Screen {
+private:
+    int rows, cols;
+    vector<char> front;  // What the terminal currently shows
+    vector<char> back;   // Frame being composed
+    bool fullRedraw;
+    string out;
 
-        return true;
+    void moveCursor(int row, int col) {
+        char buf[32];
+        int n = snprintf(buf, sizeof(buf), "\033[%d;%dH", row + 1, col + 1);
+        out.append(buf, n);
     }
 
-    void illuminateTile(int x, int y) {
-        if (x >= 0 && x < MAP_WIDTH && y >= 0 && y < MAP_HEIGHT) {
-            if (player->useBattery()) {
-                illuminated[y][x] = true;
-                
-                // Check if enemy is on this tile and activate/make visible
-                for (Enemy* enemy : enemies) {
-                    if (enemy->getX() == x && enemy->getY() == y) {
-                        enemy->makeVisible();
-                        enemy->activate();
-                    }
-                }
-            }
+public:
+    Screen() : rows(0), cols(0), fullRedraw(true) {}
+
+    // Starts a new frame; a change of frame size forces a full redraw
+    void begin(int frameRows, int frameCols) {
+        if (frameRows != rows || frameCols != cols) {
+            rows = frameRows;
+            cols = frameCols;
+            front.assign((size_t)rows * cols, ' ');
+            fullRedraw = true;
         }
+        back.assign((size_t)rows * cols, ' ');
     }
 
-    void updateEnemies() {
-        for (Enemy* enemy : enemies) {
-            // Check if player can see enemy
-            int px = player->getX();
-            int py = player->getY();
-            int ex = enemy->getX();
-            int ey = enemy->getY();
-            
-            // Simple visibility check - within 3 tiles and illuminated
-            if (abs(px - ex) <= 3 && abs(py - ey) <= 3 && illuminated[ey][ex]) {
-                enemy->makeVisible();
-                enemy->activate();
-            }
+    void put(int row, int col, char c) {
+        if (row >= 0 && row < rows && col >= 0 && col < cols) {
+            back[(size_t)row * cols + col] = c;
+        }
+    }
 
-            // Active enemies move
-            if (enemy->isActive()) {
-                enemy->move(this);
-            }
+    void text(int row, int col, const string& str) {
+        for (size_t i = 0; i < str.size(); i++) put(row, col + i, str[i]);
+    }
 
-            // Check collision with player
-            if (enemy->getX() == player->getX() && enemy->getY() == player->getY()) {
-                player->takeDamage(enemy->giveDamage());
-            }
-        }
-    }
-
-    void render() const {
-        cout << "\033[2J\033[1;1H";  // Clear screen
-        cout << "=== HOLY DIVER - Exploration Mode ===" << endl;
-        cout << "Health: " << player->getHealth() 
-             << " | Oxygen: " << player->getOxygen() 
-             << " | Battery: " << player->getBattery()
-             << " | Score: " << score << endl;
-
-        for (int y = 0; y < MAP_HEIGHT; y++) {
-            for (int x = 0; x < MAP_WIDTH; x++) {
-                if (x == player->getX() && y == player->getY()) {
-                    cout << 'P';
-                } else if (illuminated[y][x]) {
-                    // Check if collectible is here
-                    bool foundItem = false;
-                    for (const auto& col : collectibles) {
-                        if (!col.collected && col.x == x && col.y == y) {
-                            cout << col.type;
-                            foundItem = true;
-                            break;
-                        }
-                    }
-                    
-                    if (!foundItem) {
-                        // Check if enemy is here
-                        bool enemyHere = false;
-                        for (Enemy* enemy : enemies) {
-                            if (enemy->getX() == x && enemy->getY() == y && enemy->isVisible()) {
-                                cout << 'M';
-                                enemyHere = true;
-                                break;
-                            }
-                        }
-                        if (!enemyHere) {
-                            cout << map[y][x];
-                        }
+    // Next frame repaints everything (after a reset or terminal resize)
+    void invalidate() { fullRedraw = true; }
+
+    // Builds the escape sequence that turns the front buffer into the back buffer
+    const string& compose() {
+        out.clear();
+        if (fullRedraw) {
+            out += "\033[2J";
+            for (int r = 0; r < rows; r++) {
+                const char* row = &back[(size_t)r * cols];
+                int len = cols;
+                while (len > 0 && row[len - 1] == ' ') len--;  // Screen is already blank
+                if (len == 0) continue;
+                moveCursor(r, 0);
+                out.append(row, len);
+            }
+            fullRedraw = false;
+        } else {
+            for (int r = 0; r < rows; r++) {
+                const char* oldRow = &front[(size_t)r * cols];
+                const char* newRow = &back[(size_t)r * cols];
+                int c = 0;
+                while (c < cols) {
+                    if (oldRow[c] == newRow[c]) { c++; continue; }
+                    // Extend the run across short unchanged gaps, which are
+                    // cheaper to resend than another cursor move
+                    int end = c + 1, lastDiff = c;
+                    while (end < cols && end - lastDiff <= 4) {
+                        if (oldRow[end] != newRow[end]) lastDiff = end;
+                        end++;
                     }
-                } else {
-                    cout << ' ';  // Dark/unknown tile
+                    moveCursor(r, c);
+                    out.append(newRow + c, lastDiff - c + 1);
+                    c = lastDiff + 1;
                 }
             }
-            cout << endl;
         }
-
-        cout << "\nControls:" << endl;
-        cout << "WASD: Move | IJKL: Illuminate (I=up, J=left, K=down, L=right)" << endl;
-        cout << "R: Reload | Q: Quit" << endl;
-        cout << "\nCollect: * (Coins +50pts), B (Battery +30%), O (Oxygen +40%)" << endl;
+        if (!out.empty()) moveCursor(rows, 0);  // Park the cursor below the frame
+        front.swap(back);
+        return out;
     }
 
-    Player* getPlayer() { return player; }
-    bool isGameOver() const { return player->isDead(); }
-    
-    void reset(const string& filepath) {
-        if (player) delete player;
-        for (Enemy* e : enemies) delete e;
-        enemies.clear();
-        collectibles.clear();
-        score = 0;
-        
-        for (int y = 0; y < MAP_HEIGHT; y++) {
-            for (int x = 0; x < MAP_WIDTH; x++) {
-                illuminated[y][x] = false;
+    // Sends the frame diff to fd; returns the number of bytes written
+    size_t present(int fd) {
+        const string& data = compose();
+        size_t done = 0;
+        while (done < data.size()) {
+            ssize_t n = write(fd, data.data() + done, data.size() - done);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                break;
             }
+            done += n;
         }
-        
-        loadMap(filepath);
+        PROFILE_COUNT(PROF_BYTES_WRITTEN, (long long)done);
+        return done;
     }
-    
-    int getScore() const { return score; }
+
+    int getRows() const { return rows; }
+    int getCols() const { return cols; }
 };
 
-/****************************************************/
-// MovingEnemy implementation (needs World definition)
-/****************************************************/
-void MovingEnemy::move(World* world) {
-    if (!active) return;
-    
-    // Random chance to skip movement
-    if (rand() % 3 == 0) return;
-    
-    // Try random direction
-    int dir = rand() % 4;
-    int newX = x, newY = y;
-    
-    switch(dir) {
-        case 0: newY--; break;  // up
-        case 1: newY++; break;  // down
-        case 2: newX--; break;  // left
-        case 3: newX++; break;  // right
+void Profiler::draw(Screen& screen, int row) {
+    long long now = monotonic_ns();
+    if (now - rollNs >= 1000000000LL) {
+        for (int c = 0; c < PROF_COUNTER_COUNT; c++) {
+            rates[c] = (counters[c] - rolledCounters[c]) * 1e9 / (now - rollNs);
+            rolledCounters[c] = counters[c];
+        }
+        rollNs = now;
     }
-    
-    if (world->canMoveTo(newX, newY)) {
-        x = newX;
-        y = newY;
+    double scale = nsPerTick();
+    const int width = 36;
+    int col = max(0, screen.getCols() - width);
+    char line[64];
+    snprintf(line, sizeof(line), "%-*s", width, enabled ? " PROFILE         p50      p99" : " PROFILE (off)");
+    screen.text(row++, col, line);
+    for (int t = 0; t < PROF_TIMER_COUNT; t++) {
+        snprintf(line, sizeof(line), " %-14s %8s %8s  ", PROFILE_TIMER_NAMES[t],
+                 formatNs(scale * timers[t].percentile(0.5)).c_str(),
+                 formatNs(scale * timers[t].percentile(0.99)).c_str());
+        screen.text(row++, col, line);
+    }
+    for (int c = 0; c < PROF_COUNTER_COUNT; c++) {
+        snprintf(line, sizeof(line), " %-16s %12.0f/s  ", PROFILE_COUNTER_NAMES[c], rates[c]);
+        screen.text(row++, col, line);
     }
 }
 
 /****************************************************/
-// Terminal handling
+// Arena Class
 /****************************************************/
-static struct termios saved_term;
+// Bump allocator for everything that lives exactly as long as one level.
+// Nothing is freed individually: rewind() drops the whole level at once and
+// keeps the memory for the next one. Only trivially destructible types may
+// be placed here since no destructors run.
+class Arena {
+private:
+    vector<char*> blocks;
+    vector<size_t> sizes;
+    size_t current;   // Block being filled
+    size_t offset;    // Next free byte in it
 
-void setup_terminal() {
-    tcgetattr(STDIN_FILENO, &saved_term);
-    struct termios newt = saved_term;
-    newt.c_lflag &= ~(ICANON | ECHO);
-    newt.c_cc[VMIN] = 0;
-    newt.c_cc[VTIME] = 0;
-    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-}
+    Arena(const Arena&);
+    Arena& operator=(const Arena&);
 
-void restore_terminal() {
-    tcsetattr(STDIN_FILENO, TCSANOW, &saved_term);
-}
+    static const size_t MIN_BLOCK = 64 * 1024;
 
-char read_key() {
-    char ch = '\0';
-    ssize_t n = read(STDIN_FILENO, &ch, 1);
-    if (n > 0) return ch;
-    return '\0';
-}
+    void release() {
+        for (size_t i = 0; i < blocks.size(); i++) free(blocks[i]);
+        blocks.clear();
+        sizes.clear();
+    }
 
-/****************************************************/
-// Main game loop
-/****************************************************/
-int main() {
-    srand(time(NULL));
-    
-    cout << "=== HOLY DIVER ===" << endl;
-    cout << "Enter map filepath (or press Enter for default): ";
-    string filepath;
-    getline(cin, filepath);
-    
-    if (filepath.empty()) filepath = "default";
+public:
+    Arena() : current(0), offset(0) {}
+    ~Arena() { release(); }
 
-    bool playAgain = true;
-    
-    while (playAgain) {
-        World* world = new World();
-        world->loadMap(filepath);
-        
-        setup_terminal();
-        
-        bool running = true;
-        while (running) {
-            world->render();
-            
-            char input = read_key();
-            if (input != '\0') {
-                Player* p = world->getPlayer();
-                int px = p->getX();
-                int py = p->getY();
-                
-                switch(tolower(input)) {
-                    case 'w': world->requestMove(px, py, px, py-1, true); break;
-                    case 's': world->requestMove(px, py, px, py+1, true); break;
-                    case 'a': world->requestMove(px, py, px-1, py, true); break;
-                    case 'd': world->requestMove(px, py, px+1, py, true); break;
-                    case 'i': world->illuminateTile(px, py-1); break;
-                    case 'k': world->illuminateTile(px, py+1); break;
-                    case 'j': world->illuminateTile(px-1, py); break;
-                    case 'l': world->illuminateTile(px+1, py); break;
-                    case 'r': world->reset(filepath); break;
-                    case 'q': running = false; playAgain = false; break;
+    void* allocate(size_t bytes, size_t align) {
+        for (;;) {
+            if (current < blocks.size()) {
+                size_t start = (offset + align - 1) & ~(align - 1);
+                if (start + bytes <= sizes[current]) {
+                    offset = start + bytes;
+                    return blocks[current] + start;
                 }
-                
-                world->updateEnemies();
-                
-                if (world->isGameOver()) {
-                    world->render();
-                    restore_terminal();
-                    cout << "\n=== GAME OVER ===" << endl;
-                    cout << "Final Score: " << world->getScore() << endl;
-                    cout << "\nPress Enter to play again, or Q then Enter to quit: ";
-                    
-                    string response;
-                    getline(cin, response);
-                    
-                    if (!response.empty() && (response[0] == 'q' || response[0] == 'Q')) {
-                        playAgain = false;
-                    }
-                    running = false;
+                if (current + 1 < blocks.size()) {
+                    current++;
+                    offset = 0;
+                    continue;
                 }
             }
-            
-            usleep(100000);  // 100ms delay
+            // Out of blocks: grow geometrically so big levels take few mallocs
+            size_t size = max(max(bytes + align, MIN_BLOCK), sizes.empty() ? 0 : 2 * sizes.back());
+            char* block = (char*)malloc(size);
+            if (!block) throw std::bad_alloc();
+            blocks.push_back(block);
+            sizes.push_back(size);
+            current = blocks.size() - 1;
+            offset = 0;
         }
-        
-        restore_terminal();
-        delete world;
     }
-    
-    cout << "\nThanks for playing!" << endl;
-    return 0;
-}
\ No newline at end of file
+
+    // Uninitialised array of n trivially copyable values
+    template <class T>
+    T* array(size_t n) {
+        return (T*)allocate(sizeof(T) * max(n, (size_t)1), alignof(T));
+    }
+
+    template <class T>
+    T* create(const T& value) {
+        return new (allocate(sizeof(T), alignof(T))) T(value);
+    }
+
+    // Forgets everything allocated so far. A level that spilled into several
+    // blocks is folded into one block of the same total size, so reloading
+    // it costs no malloc at all.
+    void rewind() {
+        if (blocks.size() > 1) {
+            size_t total = 0;
+            for (size_t i = 0; i < sizes.size(); i++) total += sizes[i];
+            release();
+            char* block = (char*)malloc(total);
+            if (!block) throw std::bad_alloc();
+            blocks.push_back(block);
+            sizes.push_back(total);
+        }
+        current = 0;
+        offset = 0;
+    }
+
+    size_t reserved() const {
+        size_t total = 0;
+        for (size_t i = 0; i < sizes.size(); i++) total += sizes[i];
+        return total;
+    }
+};
+
+const size_t Arena::MIN_BLOCK;
+
+/****************************************************/
+// Tile Index Class
+/****************************************************/
+// Finds the entities standing on a tile in O(1). Every tile stores the id of
+// its first occupant and every entity links to the next one on the same tile.
+// Sparse maps keep the per-tile heads in an open-addressing hash instead of a
+// full grid. All storage comes from the world's arena.
+class TileIndex {
+private:
+    struct Slot {
+        size_t key;
+        int head;
+    };
+
+    int width;
+    bool sparse;
+    int* heads;       // Dense: one per tile
+    Slot* slots;      // Sparse: twice the entity count, so never full
+    size_t mask;
+    int* next;
+
+    static const size_t EMPTY = (size_t)-1;
+
+    size_t key(int x, int y) const { return (size_t)y * width + x; }
+    size_t home(size_t k) const { return (size_t)((k * 0x9E3779B97F4A7C15ULL) >> 32) & mask; }
+
+    size_t find(size_t k) const {
+        size_t i = home(k);
+        while (slots[i].key != EMPTY && slots[i].key != k) i = (i + 1) & mask;
+        return i;
+    }
+
+    int getHead(int x, int y) const {
+        if (!sparse) return heads[key(x, y)];
+        const Slot& slot = slots[find(key(x, y))];
+        return slot.key == EMPTY ? NONE : slot.head;
+    }
+
+    void setHead(int x, int y, int id) {
+        if (!sparse) {
+            heads[key(x, y)] = id;
+            return;
+        }
+        size_t i = find(key(x, y));
+        if (id != NONE) {
+            slots[i].key = key(x, y);
+            slots[i].head = id;
+            return;
+        }
+        if (slots[i].key == EMPTY) return;
+        // Backward-shift deletion keeps every probe run unbroken
+        for (size_t j = (i + 1) & mask; slots[j].key != EMPTY; j = (j + 1) & mask) {
+            size_t h = home(slots[j].key);
+            if (((j - h) & mask) >= ((j - i) & mask)) {
+                slots[i] = slots[j];
+                i = j;
+            }
+        }
+        slots[i].key = EMPTY;
+    }
+
+public:
+    static const int NONE = -1;
+
+    TileIndex() : width(0), sparse(false), heads(nullptr), slots(nullptr), mask(0), next(nullptr) {}
+
+    void reset(Arena& arena, int w, int h, int entityCount, bool forceSparse) {
+        width = w;
+        sparse = forceSparse || (size_t)w * h > (size_t)SPARSE_INDEX_RATIO * max(entityCount, 1024);
+        heads = nullptr;
+        slots = nullptr;
+        if (sparse) {
+            size_t capacity = 16;
+            while (capacity < 2 * (size_t)entityCount) capacity *= 2;
+            slots = arena.array<Slot>(capacity);
+            for (size_t i = 0; i < capacity; i++) slots[i].key = EMPTY;
+            mask = capacity - 1;
+        } else {
+            heads = arena.array<int>((size_t)w * h);
+            fill(heads, heads + (size_t)w * h, NONE);
+        }
+        next = arena.array<int>(entityCount);
+        fill(next, next + entityCount, NONE);
+    }
+
+    void insert(int id, int x, int y) {
+        next[id] = getHead(x, y);
+        setHead(x, y, id);
+    }
+
+    void remove(int id, int x, int y) {
+        int cur = getHead(x, y);
+        if (cur == id) {
+            setHead(x, y, next[id]);
+        } else {
+            while (cur != NONE && next[cur] != id) cur = next[cur];
+            if (cur != NONE) next[cur] = next[id];
+        }
+        next[id] = NONE;
+    }
+
+    void move(int id, int oldX, int oldY, int newX, int newY) {
+        remove(id, oldX, oldY);
+        insert(id, newX, newY);
+    }
+
+    int first(int x, int y) const { return getHead(x, y); }
+    int nextOf(int id) const { return next[id]; }
+};
+
+const size_t TileIndex::EMPTY;
+const int TileIndex::NONE;
+
+/****************************************************/
+// Mapped File Class
+/****************************************************/
+// Read-only memory mapping of a whole file, unmapped on destruction
+class MappedFile {
+private:
+    const char* bytes;
+    size_t length;
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+public:
+    MappedFile() : bytes(nullptr), length(0) {}
+
+    ~MappedFile() {
+        if (bytes) munmap((void*)bytes, length);
+    }
+
+    bool open(const string& path, string& error) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            error = path + ": " + strerror(errno);
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            error = path + ": " + strerror(errno);
+            close(fd);
+            return false;
+        }
+        length = st.st_size;
+        if (length > 0) {
+            void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                error = path + ": " + strerror(errno);
+                close(fd);
+                length = 0;
+                return false;
+            }
+            madvise(p, length, MADV_SEQUENTIAL);
+            bytes = (const char*)p;
+        }
+        close(fd);
+        return true;
+    }
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+/****************************************************/
+// Binary Map Format
+/****************************************************/
+// Version 1 layout, little-endian, each section starting 8-byte aligned:
+//   BinaryMapHeader
+//   tiles         width * height bytes of 'x' or 'o', row-major
+//   enemies       for each kind: int32 x[n], int32 y[n], int32 damage[n]
+//   collectibles  n records of { int32 x, int32 y, char type, 3 zero bytes }
+// Enemy kinds and damage are fixed when the map is converted, so loading is
+// a bounds check and one copy per array instead of a parse.
+const char BINARY_MAP_MAGIC[8] = { 'H', 'D', 'I', 'V', 'E', 'M', 'A', 'P' };
+const uint32_t BINARY_MAP_VERSION = 1;
+
+struct BinaryMapHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t width, height;
+    uint32_t playerX, playerY;
+    uint32_t enemyCount[ENEMY_KIND_COUNT];
+    uint32_t collectibleCount;
+    uint64_t tilesOffset;
+    uint64_t enemiesOffset;
+    uint64_t collectiblesOffset;
+};
+
+struct BinaryCollectible {
+    int32_t x, y;
+    char type;
+    char padding[3];
+};
+
+inline uint64_t align8(uint64_t n) { return (n + 7) & ~(uint64_t)7; }
+
+bool is_binary_map(const MappedFile& file) {
+    return file.size() >= sizeof(BINARY_MAP_MAGIC) &&
+           memcmp(file.data(), BINARY_MAP_MAGIC, sizeof(BINARY_MAP_MAGIC)) == 0;
+}
+
+/****************************************************/
+// Embedded Levels
+/****************************************************/
+// Levels compiled into the program, in the text map format with one string
+// per row. Rows are declared char[H][W + 1] so each W-tile string keeps its
+// terminator. embed_level checks a level while compiling and throws on a
+// bad one, which BUNDLED_LEVELS being constexpr turns into a build error: a
+// short row reads as a '\0' tile, so an unknown tile, a ragged row or
+// anything but one 'P' fails the build, and loading a bundled level needs
+// no parsing or validation.
+// The recursion halves the range each step, so its depth stays logarithmic
+// in the level's size.
+struct EmbeddedLevel {
+    const char* name;
+    int width, height;
+    int playerX, playerY;
+    const char* rows;  // height rows of width tiles, each followed by '\0'
+};
+
+constexpr bool level_tile_ok(char c) {
+    return c == 'x' || c == 'o' || c == 'P' || c == 'M' || c == COIN || c == BATTERY_PACK || c == OXYGEN_TANK;
+}
+
+// Counts the tiles in cells [begin, end) that are not allowed
+template <int H, int S>
+constexpr int level_bad_tiles(const char (&rows)[H][S], int begin, int end) {
+    return end - begin == 1
+        ? !level_tile_ok(rows[begin / (S - 1)][begin % (S - 1)])
+        : level_bad_tiles(rows, begin, begin + (end - begin) / 2) +
+          level_bad_tiles(rows, begin + (end - begin) / 2, end);
+}
+
+// Counts the cells in [begin, end) holding `tile`
+template <int H, int S>
+constexpr int level_count(const char (&rows)[H][S], int begin, int end, char tile) {
+    return end - begin == 1
+        ? rows[begin / (S - 1)][begin % (S - 1)] == tile
+        : level_count(rows, begin, begin + (end - begin) / 2, tile) +
+          level_count(rows, begin + (end - begin) / 2, end, tile);
+}
+
+constexpr int level_first(int a, int b) { return a >= 0 ? a : b; }
+
+// First cell in [begin, end) holding `tile`, or -1
+template <int H, int S>
+constexpr int level_find(const char (&rows)[H][S], int begin, int end, char tile) {
+    return end - begin == 1
+        ? (rows[begin / (S - 1)][begin % (S - 1)] == tile ? begin : -1)
+        : level_first(level_find(rows, begin, begin + (end - begin) / 2, tile),
+                      level_find(rows, begin + (end - begin) / 2, end, tile));
+}
+
+template <int H, int S>
+constexpr bool level_tiles_ok(const char (&rows)[H][S]) {
+    return S > 1 && level_bad_tiles(rows, 0, H * (S - 1)) == 0;
+}
+
+template <int H, int S>
+constexpr int level_players(const char (&rows)[H][S]) {
+    return level_count(rows, 0, H * (S - 1), 'P');
+}
+
+template <int H, int S>
+constexpr EmbeddedLevel embed_level(const char* name, const char (&rows)[H][S]) {
+    return !level_tiles_ok(rows) ? throw std::logic_error("bundled level: unknown tile or short row")
+         : level_players(rows) != 1 ? throw std::logic_error("bundled level: needs exactly one 'P'")
+         : EmbeddedLevel{ name, S - 1, H,
+                          level_find(rows, 0, H * (S - 1), 'P') % (S - 1),
+                          level_find(rows, 0, H * (S - 1), 'P') / (S - 1), &rows[0][0] };
+}
+
+// A sheltered reef: coins in the open, tanks behind the rocks
+constexpr char LEVEL_REEF[16][41] = {
+    "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx",
+    "xoooooooooooooxxooooooooooooooooooooooox",
+    "xoPoooo*oooooooxooooo*oooooooxxxoooo*oox",
+    "xoooooooooxxoooooooooooooMoooxOxooooooox",
+    "xooo*ooooxxxxooooooxxoooooooooooooooooox",
+    "xoooooooooxxooo*ooxxxxooooooo*oooooMooox",
+    "xoooxxooooooooooooxBxxooooooooooooooooox",
+    "xoooxxoooooMoooooooooooooxxxxooooo*oooox",
+    "xoo*ooooooooooooooooo*ooooxxooooooooooox",
+    "xoooooooooooxxxxooooooooooooooooxxooooox",
+    "xooooMooooooxOoxoooooooMoooo*oooxxooooox",
+    "xoooooooo*ooxoxxooooooooooooooooooooooox",
+    "xooxxoooooooooooooo*ooooxxoooooBooooooox",
+    "xooxxooooooooMooooooooooxxoooooooooo*oox",
+    "xoooooo*oooooooooooxxoooooooooMoooooooox",
+    "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx"
+};
+
+// A long trench cut by rock walls, each with one gap to swim through
+constexpr char LEVEL_TRENCH[12][61] = {
+    "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx",
+    "xoooooooxooooooxooooooxooooMoxooooooxooM*Boxoo*oooxooooo*o*x",
+    "xoooooMoxooooooxooooooxo*ooooxooooooooooooooooooooxoooooooox",
+    "xoooooooxooooooooooMooxooOoooxooooo*ooooooooooooooxoooooooox",
+    "xoooooooooooooooooooooxooooooxooooooxooooooxooooooxMooooooox",
+    "xoPooooooooooooxooooooooo*oo*xoooo*oxooooooxooooooxoooooooox",
+    "xoooooooxooooooxooooooMooooooxooooooxooMoooxoooo*oxooooo*oox",
+    "xoooooooxoooMooxooooooxoooooooooooooxoOOoooxooooooxoooooooox",
+    "xoooooooxooooooxooooooxoooooooooooooxooooooxooooooooooooooox",
+    "xoooooooxooooooxooooooxooooooxooooooxooooooxo*ooooooooooooox",
+    "xoooooooxooooooxooooooxooooooxooooooxoMooooxooooooxooooBooox",
+    "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx"
+};
+
+constexpr EmbeddedLevel BUNDLED_LEVELS[] = {
+    embed_level("reef", LEVEL_REEF),
+    embed_level("trench", LEVEL_TRENCH)
+};
+constexpr int BUNDLED_LEVEL_COUNT = sizeof(BUNDLED_LEVELS) / sizeof(BUNDLED_LEVELS[0]);
+
+/****************************************************/
+// Snapshot Format
+/****************************************************/
+// The complete state of a game in one flat buffer, used in memory for
+// instant resets and written out as save games. Same conventions as the
+// binary map; sections follow each other, each 8-byte aligned:
+//   SnapshotHeader
+//   tiles         width * height bytes, only with SNAPSHOT_HAS_TILES; without
+//                 them the snapshot restores onto the terrain already loaded
+//                 (a streamed map's terrain stays in its map file)
+//   enemies       for each kind: int32 x[n], y[n], damage[n], then
+//                 uint8 active[n], visible[n]
+//   collectibles  n SavedCollectible records
+//   fog           n SavedFogBlock records, one per block with a lit tile
+const char SNAPSHOT_MAGIC[8] = { 'H', 'D', 'I', 'V', 'S', 'A', 'V', 'E' };
+const uint32_t SNAPSHOT_VERSION = 3;
+const uint32_t SNAPSHOT_HAS_TILES = 1;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t width, height;
+    int32_t score;
+    int32_t playerX, playerY;
+    int32_t health, oxygen, battery, lives;
+    uint32_t enemyCount[ENEMY_KIND_COUNT];
+    uint32_t collectibleCount;
+    uint32_t fogBlockCount;
+    uint32_t padding;
+    uint64_t rng[WORLD_RNG_STREAMS][4];
+};
+
+struct SavedCollectible {
+    int32_t x, y;
+    char type;
+    char collected;
+    char padding[2];
+};
+
+struct SavedFogBlock {
+    uint32_t position;  // Index into the fog map's block directory
+    uint32_t padding;
+    uint64_t rows[64];
+};
+
+inline void snapshot_put(vector<char>& out, const void* data, size_t bytes) {
+    const char* p = (const char*)data;
+    out.insert(out.end(), p, p + bytes);
+}
+
+inline void snapshot_align(vector<char>& out) { out.resize(align8(out.size()), 0); }
+
+// Bounds-checked cursor over a snapshot; take() returns null past the end
+struct SnapshotReader {
+    const char* base;
+    uint64_t size, offset;
+
+    SnapshotReader(const char* data, uint64_t n) : base(data), size(n), offset(0) {}
+
+    const char* take(uint64_t bytes) {
+        if (bytes > size - offset) return nullptr;
+        const char* p = base + offset;
+        offset += bytes;
+        return p;
+    }
+
+    void align() { offset = min(size, align8(offset)); }
+};
+
+// 64-bit hash of a byte range, eight bytes at a time; `h` chains ranges
+inline uint64_t hash_bytes(const void* data, size_t n, uint64_t h) {
+    const char* p = (const char*)data;
+    h ^= n * 0x9E3779B97F4A7C15ULL;
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        h = (h ^ word) * 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 31;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p, n);
+    h = (h ^ tail) * 0x94D049BB133111EBULL;
+    return h ^ (h >> 29);
+}
+
+/****************************************************/
+// Chunk Cache Class
+/****************************************************/
+// Pages CHUNK_SIZE x CHUNK_SIZE tile chunks in from a binary map's tile grid
+// on demand and keeps at most `budget` of them, evicting the least recently
+// used one, so terrain memory stays fixed however large the map is.
+class ChunkCache {
+private:
+    int fd;
+    uint64_t tilesOffset;
+    int width, height;
+    int budget;
+    vector<char> tiles;         // CHUNK_SIZE * CHUNK_SIZE tiles per slot
+    vector<uint64_t> keys;      // Chunk held by each slot
+    vector<int> newer, older;   // LRU list through the slots
+    int newest, oldest;
+    int used;
+    unordered_map<uint64_t, int> slots;
+    long long loads;
+
+    ChunkCache(const ChunkCache&);
+    ChunkCache& operator=(const ChunkCache&);
+
+    static uint64_t key(int cx, int cy) { return ((uint64_t)(uint32_t)cy << 32) | (uint32_t)cx; }
+
+    void unlink(int slot) {
+        if (newer[slot] >= 0) older[newer[slot]] = older[slot]; else newest = older[slot];
+        if (older[slot] >= 0) newer[older[slot]] = newer[slot]; else oldest = newer[slot];
+    }
+
+    void pushNewest(int slot) {
+        newer[slot] = -1;
+        older[slot] = newest;
+        if (newest >= 0) newer[newest] = slot;
+        newest = slot;
+        if (oldest < 0) oldest = slot;
+    }
+
+    // Reads chunk (cx, cy) into a slot, evicting the oldest chunk if full.
+    // Tiles past the map edge, unreadable bytes and anything other than
+    // open water read as rock.
+    int load(int cx, int cy) {
+        int slot;
+        if (used < budget) {
+            slot = used++;
+        } else {
+            slot = oldest;
+            unlink(slot);
+            slots.erase(keys[slot]);
+        }
+        char* dst = &tiles[(size_t)slot * CHUNK_SIZE * CHUNK_SIZE];
+        memset(dst, 'x', CHUNK_SIZE * CHUNK_SIZE);
+        int x0 = cx * CHUNK_SIZE, y0 = cy * CHUNK_SIZE;
+        int cols = min(CHUNK_SIZE, width - x0);
+        for (int r = 0; r < CHUNK_SIZE && y0 + r < height; r++) {
+            char* row = dst + r * CHUNK_SIZE;
+            off_t at = tilesOffset + (uint64_t)(y0 + r) * width + x0;
+            if (pread(fd, row, cols, at) != cols) {
+                memset(row, 'x', CHUNK_SIZE);
+                continue;
+            }
+            for (int c = 0; c < cols; c++) {
+                if (row[c] != 'o') row[c] = 'x';
+            }
+        }
+        keys[slot] = key(cx, cy);
+        slots[keys[slot]] = slot;
+        pushNewest(slot);
+        loads++;
+        return slot;
+    }
+
+    int find(int cx, int cy) const {
+        unordered_map<uint64_t, int>::const_iterator it = slots.find(key(cx, cy));
+        return it == slots.end() ? -1 : it->second;
+    }
+
+public:
+    ChunkCache() : fd(-1), tilesOffset(0), width(0), height(0), budget(0),
+                   newest(-1), oldest(-1), used(0), loads(0) {}
+
+    ~ChunkCache() { close(); }
+
+    bool open(const string& path, const BinaryMapHeader& header, int chunkBudget, string& error) {
+        close();
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            error = path + ": " + strerror(errno);
+            return false;
+        }
+        tilesOffset = header.tilesOffset;
+        width = header.width;
+        height = header.height;
+        budget = max(chunkBudget, MIN_CHUNK_BUDGET);
+        tiles.assign((size_t)budget * CHUNK_SIZE * CHUNK_SIZE, 'x');
+        keys.assign(budget, 0);
+        newer.assign(budget, -1);
+        older.assign(budget, -1);
+        return true;
+    }
+
+    void close() {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+        tiles.clear();
+        slots.clear();
+        newest = oldest = -1;
+        used = 0;
+    }
+
+    bool isOpen() const { return fd >= 0; }
+
+    // Tile at (x, y), paging its chunk in and marking it most recently used
+    char tile(int x, int y) {
+        int cx = x / CHUNK_SIZE, cy = y / CHUNK_SIZE;
+        int slot = find(cx, cy);
+        if (slot < 0) {
+            slot = load(cx, cy);
+        } else if (slot != newest) {
+            unlink(slot);
+            pushNewest(slot);
+        }
+        return tiles[(size_t)slot * CHUNK_SIZE * CHUNK_SIZE + (y % CHUNK_SIZE) * CHUNK_SIZE + x % CHUNK_SIZE];
+    }
+
+    // Tile at (x, y) if its chunk is resident, otherwise -1; never pages in
+    int peek(int x, int y) const {
+        int slot = find(x / CHUNK_SIZE, y / CHUNK_SIZE);
+        if (slot < 0) return -1;
+        return tiles[(size_t)slot * CHUNK_SIZE * CHUNK_SIZE + (y % CHUNK_SIZE) * CHUNK_SIZE + x % CHUNK_SIZE];
+    }
+
+    // Pages in every chunk within `radius` chunks of the one holding (x, y)
+    void prefetch(int x, int y, int radius) {
+        int cx = x / CHUNK_SIZE, cy = y / CHUNK_SIZE;
+        for (int dy = -radius; dy <= radius; dy++) {
+            for (int dx = -radius; dx <= radius; dx++) {
+                int tx = (cx + dx) * CHUNK_SIZE, ty = (cy + dy) * CHUNK_SIZE;
+                if (tx >= 0 && tx < width && ty >= 0 && ty < height) tile(tx, ty);
+            }
+        }
+    }
+
+    int residentChunks() const { return used; }
+    long long chunkLoads() const { return loads; }
+};
+
+/****************************************************/
+// Fog Map Class
+/****************************************************/
+// One bit per tile: set once the tile has been lit. Bits live in 64x64 tile
+// blocks, one 64-bit word per block row, allocated the first time something
+// in the block is lit; dark areas cost only their directory entry. Clears,
+// dark-run skipping and counting all work a word at a time.
+class FogMap {
+private:
+    int width, height;
+    int blocksX;
+    vector<int> directory;    // Block number per 64x64 area, -1 while all dark
+    vector<uint64_t> blocks;  // 64 row words per allocated block
+    long long litCount;
+
+    uint64_t word(int wordX, int y) const {
+        int b = directory[(size_t)(y >> 6) * blocksX + wordX];
+        return b < 0 ? 0 : blocks[(size_t)b * 64 + (y & 63)];
+    }
+
+public:
+    FogMap() : width(0), height(0), blocksX(0), litCount(0) {}
+
+    // Resizes to w x h with every tile dark
+    void reset(int w, int h) {
+        width = w;
+        height = h;
+        blocksX = (w + 63) / 64;
+        directory.assign((size_t)blocksX * ((h + 63) / 64), -1);
+        blocks.clear();
+        litCount = 0;
+    }
+
+    void clear() {
+        fill(directory.begin(), directory.end(), -1);
+        blocks.clear();
+        litCount = 0;
+    }
+
+    bool test(int x, int y) const {
+        return (word(x >> 6, y) >> (x & 63)) & 1;
+    }
+
+    void set(int x, int y) {
+        int& b = directory[(size_t)(y >> 6) * blocksX + (x >> 6)];
+        if (b < 0) {
+            b = blocks.size() / 64;
+            blocks.resize(blocks.size() + 64, 0);
+        }
+        uint64_t& w = blocks[(size_t)b * 64 + (y & 63)];
+        uint64_t bit = (uint64_t)1 << (x & 63);
+        if (!(w & bit)) {
+            w |= bit;
+            litCount++;
+        }
+    }
+
+    // First column in [x, end) of row y whose bit equals `lit`, or end
+    int scan(int y, int x, int end, bool lit) const {
+        while (x < end) {
+            uint64_t bits = word(x >> 6, y);
+            if (!lit) bits = ~bits;
+            bits >>= (x & 63);
+            if (bits) return min(end, x + __builtin_ctzll(bits));
+            x = (x | 63) + 1;  // Whole rest of the word is the wrong kind
+        }
+        return end;
+    }
+
+    int nextLit(int y, int x, int end) const { return scan(y, x, end, true); }
+    int nextDark(int y, int x, int end) const { return scan(y, x, end, false); }
+
+    long long count() const { return litCount; }
+
+    // 64x64 blocks allocated so far, lit or not
+    size_t blockCount() const { return blocks.size() / 64; }
+
+    // Appends one SavedFogBlock per allocated block; returns how many
+    uint32_t save(vector<char>& out) const {
+        uint32_t saved = 0;
+        for (size_t pos = 0; pos < directory.size(); pos++) {
+            if (directory[pos] < 0) continue;
+            SavedFogBlock rec;
+            rec.position = pos;
+            rec.padding = 0;
+            memcpy(rec.rows, &blocks[(size_t)directory[pos] * 64], sizeof(rec.rows));
+            snapshot_put(out, &rec, sizeof(rec));
+            saved++;
+        }
+        return saved;
+    }
+
+    // Checks saved blocks against a w x h map: positions strictly increasing
+    // as save() writes them, no lit bits past the right or bottom edge
+    static bool check(int width, int height, const SavedFogBlock* recs, uint32_t n) {
+        int blocksX = (width + 63) / 64;
+        uint64_t positions = (uint64_t)blocksX * ((height + 63) / 64);
+        uint32_t previous = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            SavedFogBlock rec;
+            memcpy(&rec, &recs[i], sizeof(rec));
+            if (rec.position >= positions) return false;
+            if (i > 0 && rec.position <= previous) return false;
+            previous = rec.position;
+            int left = (rec.position % blocksX) * 64, top = (rec.position / blocksX) * 64;
+            uint64_t allowed = width - left >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << (width - left)) - 1;
+            for (int r = 0; r < 64; r++) {
+                if (rec.rows[r] & ~(top + r < height ? allowed : 0)) return false;
+            }
+        }
+        return true;
+    }
+
+    // Replaces the fog with checked saved blocks; the size must match
+    void load(const SavedFogBlock* recs, uint32_t n) {
+        clear();
+        blocks.resize((size_t)n * 64);
+        for (uint32_t i = 0; i < n; i++) {
+            SavedFogBlock rec;
+            memcpy(&rec, &recs[i], sizeof(rec));
+            directory[rec.position] = i;
+            memcpy(&blocks[(size_t)i * 64], rec.rows, sizeof(rec.rows));
+        }
+        litCount = popcount();
+    }
+
+    // Recomputes the lit count from the bits themselves
+    long long popcount() const {
+        long long total = 0;
+        for (size_t i = 0; i < blocks.size(); i++) total += __builtin_popcountll(blocks[i]);
+        return total;
+    }
+
+    size_t memoryBytes() const {
+        return directory.size() * sizeof(int) + blocks.size() * sizeof(uint64_t);
+    }
+};
+
+/****************************************************/
+// Enemy Scan Kernels
+/****************************************************/
+// Batch tests over packed enemy coordinates, 8 lanes at a time with AVX2,
+// SSE2 or NEON and one at a time otherwise. The scalar versions are the
+// reference the vector paths must match exactly.
+
+// Writes the indices of enemies within `range` tiles (Chebyshev) of (px, py)
+// to `out` and returns how many there are
+int find_nearby_scalar(const int* xs, const int* ys, int n, int px, int py, int range, int* out) {
+    int found = 0;
+    for (int i = 0; i < n; i++) {
+        if (abs(px - xs[i]) <= range && abs(py - ys[i]) <= range) out[found++] = i;
+    }
+    return found;
+}
+
+// Total damage of the enemies standing on (px, py)
+int collision_damage_scalar(const int* xs, const int* ys, const int* damage, int n, int px, int py) {
+    int total = 0;
+    for (int i = 0; i < n; i++) {
+        if (xs[i] == px && ys[i] == py) total += damage[i];
+    }
+    return total;
+}
+
+int find_nearby(const int* xs, const int* ys, int n, int px, int py, int range, int* out) {
+    int found = 0;
+    int i = 0;
+#if defined(__AVX2__)
+    const __m256i vpx = _mm256_set1_epi32(px), vpy = _mm256_set1_epi32(py);
+    const __m256i vrange = _mm256_set1_epi32(range);
+    for (; i + 8 <= n; i += 8) {
+        __m256i dx = _mm256_abs_epi32(_mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)(xs + i)), vpx));
+        __m256i dy = _mm256_abs_epi32(_mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)(ys + i)), vpy));
+        __m256i far = _mm256_or_si256(_mm256_cmpgt_epi32(dx, vrange), _mm256_cmpgt_epi32(dy, vrange));
+        unsigned mask = ~_mm256_movemask_ps(_mm256_castsi256_ps(far)) & 0xFF;
+        while (mask) {
+            out[found++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__SSE2__)
+    // No 32-bit abs in SSE2, so test -range <= d <= range directly
+    const __m128i vpx = _mm_set1_epi32(px), vpy = _mm_set1_epi32(py);
+    const __m128i hi = _mm_set1_epi32(range), lo = _mm_set1_epi32(-range);
+    for (; i + 8 <= n; i += 8) {
+        unsigned mask = 0;
+        for (int half = 0; half < 2; half++) {
+            __m128i dx = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(xs + i + half * 4)), vpx);
+            __m128i dy = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(ys + i + half * 4)), vpy);
+            __m128i far = _mm_or_si128(_mm_or_si128(_mm_cmpgt_epi32(dx, hi), _mm_cmplt_epi32(dx, lo)),
+                                       _mm_or_si128(_mm_cmpgt_epi32(dy, hi), _mm_cmplt_epi32(dy, lo)));
+            mask |= (~_mm_movemask_ps(_mm_castsi128_ps(far)) & 0xF) << (half * 4);
+        }
+        while (mask) {
+            out[found++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__ARM_NEON)
+    const int32x4_t vpx = vdupq_n_s32(px), vpy = vdupq_n_s32(py);
+    const uint32x4_t vrange = vdupq_n_u32(range);
+    const uint32x4_t lanes = { 1, 2, 4, 8 };
+    for (; i + 8 <= n; i += 8) {
+        unsigned mask = 0;
+        for (int half = 0; half < 2; half++) {
+            uint32x4_t dx = vreinterpretq_u32_s32(vabdq_s32(vld1q_s32(xs + i + half * 4), vpx));
+            uint32x4_t dy = vreinterpretq_u32_s32(vabdq_s32(vld1q_s32(ys + i + half * 4), vpy));
+            uint32x4_t near = vandq_u32(vcleq_u32(dx, vrange), vcleq_u32(dy, vrange));
+            mask |= vaddvq_u32(vandq_u32(near, lanes)) << (half * 4);
+        }
+        while (mask) {
+            out[found++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (abs(px - xs[i]) <= range && abs(py - ys[i]) <= range) out[found++] = i;
+    }
+    return found;
+}
+
+int collision_damage(const int* xs, const int* ys, const int* damage, int n, int px, int py) {
+    int total = 0;
+    int i = 0;
+#if defined(__AVX2__)
+    const __m256i vpx = _mm256_set1_epi32(px), vpy = _mm256_set1_epi32(py);
+    __m256i sum = _mm256_setzero_si256();
+    for (; i + 8 <= n; i += 8) {
+        __m256i hit = _mm256_and_si256(
+            _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(xs + i)), vpx),
+            _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(ys + i)), vpy));
+        sum = _mm256_add_epi32(sum, _mm256_and_si256(hit, _mm256_loadu_si256((const __m256i*)(damage + i))));
+    }
+    int lanes[8];
+    _mm256_storeu_si256((__m256i*)lanes, sum);
+    for (int l = 0; l < 8; l++) total += lanes[l];
+#elif defined(__SSE2__)
+    const __m128i vpx = _mm_set1_epi32(px), vpy = _mm_set1_epi32(py);
+    __m128i sum = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8) {
+        for (int half = 0; half < 8; half += 4) {
+            __m128i hit = _mm_and_si128(
+                _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(xs + i + half)), vpx),
+                _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(ys + i + half)), vpy));
+            sum = _mm_add_epi32(sum, _mm_and_si128(hit, _mm_loadu_si128((const __m128i*)(damage + i + half))));
+        }
+    }
+    int lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, sum);
+    for (int l = 0; l < 4; l++) total += lanes[l];
+#elif defined(__ARM_NEON)
+    const int32x4_t vpx = vdupq_n_s32(px), vpy = vdupq_n_s32(py);
+    int32x4_t sum = vdupq_n_s32(0);
+    for (; i + 8 <= n; i += 8) {
+        for (int half = 0; half < 8; half += 4) {
+            uint32x4_t hit = vandq_u32(vceqq_s32(vld1q_s32(xs + i + half), vpx),
+                                       vceqq_s32(vld1q_s32(ys + i + half), vpy));
+            sum = vaddq_s32(sum, vandq_s32(vreinterpretq_s32_u32(hit), vld1q_s32(damage + i + half)));
+        }
+    }
+    total = vaddvq_s32(sum);
+#endif
+    return total + collision_damage_scalar(xs + i, ys + i, damage + i, n - i, px, py);
+}
+
+/****************************************************/
+// Worker Pool
+/****************************************************/
+// Threads that stay parked between jobs so a job costs a wakeup, not a
+// thread start. A job is a number of chunks handed out as one contiguous
+// range per thread (the caller included); a thread that finishes its own
+// range steals chunks from the others' ranges, so uneven chunks balance
+// out. Every chunk runs exactly once, whoever takes it.
+struct ParallelTask {
+    virtual ~ParallelTask() {}
+    virtual void run(int chunk) = 0;
+};
+
+class WorkerPool {
+private:
+    struct Range {
+        atomic<int> next;
+        int end;
+        char padding[56];  // One range per cache line
+    };
+
+    vector<thread> threads;
+    Range* ranges;
+    mutex lock;
+    condition_variable wake, finished;
+    ParallelTask* task;
+    unsigned long long generation;
+    int busy;
+    bool stopping;
+
+    WorkerPool(const WorkerPool&);
+    WorkerPool& operator=(const WorkerPool&);
+
+    void work(int self) {
+        int participants = threads.size() + 1;
+        for (int k = 0; k < participants; k++) {
+            Range& r = ranges[(self + k) % participants];
+            for (int chunk = r.next++; chunk < r.end; chunk = r.next++) task->run(chunk);
+        }
+    }
+
+    void loop(int self) {
+        unsigned long long seen = 0;
+        for (;;) {
+            {
+                unique_lock<mutex> guard(lock);
+                wake.wait(guard, [&]() { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            work(self);
+            {
+                lock_guard<mutex> guard(lock);
+                busy--;
+            }
+            finished.notify_one();
+        }
+    }
+
+public:
+    // `helpers` threads besides the caller; 0 runs every job inline
+    explicit WorkerPool(int helpers)
+        : ranges(new Range[helpers + 1]), task(nullptr), generation(0), busy(0), stopping(false) {
+        for (int t = 0; t < helpers; t++) threads.push_back(thread(&WorkerPool::loop, this, t + 1));
+    }
+
+    ~WorkerPool() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+        delete[] ranges;
+    }
+
+    int size() const { return threads.size() + 1; }
+
+    // Runs task->run(c) for every c in [0, chunks) and returns when all are done
+    void run(ParallelTask* job, int chunks) {
+        int participants = size();
+        if (participants == 1 || chunks <= 1) {
+            for (int c = 0; c < chunks; c++) job->run(c);
+            return;
+        }
+        for (int t = 0; t < participants; t++) {
+            ranges[t].next = (long long)chunks * t / participants;
+            ranges[t].end = (long long)chunks * (t + 1) / participants;
+        }
+        {
+            lock_guard<mutex> guard(lock);
+            task = job;
+            busy = participants - 1;
+            generation++;
+        }
+        wake.notify_all();
+        work(0);
+        unique_lock<mutex> guard(lock);
+        finished.wait(guard, [&]() { return busy == 0; });
+    }
+};
+
+/****************************************************/
+// Flow Field Class
+/****************************************************/
+// Breadth-first step counts to the diver over a window centred on the diver,
+// shared by every chasing enemy: an enemy steps to any neighbour one step
+// closer, in O(1), and the whole field costs one BFS over the window when
+// the diver moves, however many enemies chase. A step is a rebuild, not a
+// repair: moving the source one tile flips the parity of every distance on
+// the grid, so there is no bounded region whose distances change.
+class FlowField {
+private:
+    int originX, originY;   // Map position of the window's top-left tile
+    int sourceX, sourceY;
+    bool valid;
+    vector<uint8_t> dist;
+    vector<int> queue;
+
+public:
+    FlowField() : originX(0), originY(0), sourceX(0), sourceY(0), valid(false),
+                  dist(FLOW_FIELD_SIZE * FLOW_FIELD_SIZE, FLOW_UNREACHED),
+                  queue(FLOW_FIELD_SIZE * FLOW_FIELD_SIZE) {}
+
+    void invalidate() { valid = false; }
+    bool isFor(int x, int y) const { return valid && x == sourceX && y == sourceY; }
+
+    template <class Passable>
+    void build(int sx, int sy, Passable passable) {
+        static const int dx[] = { 0, 0, -1, 1 };
+        static const int dy[] = { -1, 1, 0, 0 };
+        originX = sx - FLOW_FIELD_SIZE / 2;
+        originY = sy - FLOW_FIELD_SIZE / 2;
+        sourceX = sx;
+        sourceY = sy;
+        valid = true;
+        fill(dist.begin(), dist.end(), FLOW_UNREACHED);
+
+        int head = 0, tail = 0;
+        int start = (FLOW_FIELD_SIZE / 2) * FLOW_FIELD_SIZE + FLOW_FIELD_SIZE / 2;
+        dist[start] = 0;
+        queue[tail++] = start;
+        while (head < tail) {
+            int cell = queue[head++];
+            int next = dist[cell] + 1;
+            if (next >= FLOW_UNREACHED) break;  // Everything after is as far
+            int lx = cell % FLOW_FIELD_SIZE, ly = cell / FLOW_FIELD_SIZE;
+            for (int d = 0; d < 4; d++) {
+                int nx = lx + dx[d], ny = ly + dy[d];
+                if (nx < 0 || ny < 0 || nx >= FLOW_FIELD_SIZE || ny >= FLOW_FIELD_SIZE) continue;
+                int n = ny * FLOW_FIELD_SIZE + nx;
+                if (dist[n] != FLOW_UNREACHED || !passable(originX + nx, originY + ny)) continue;
+                dist[n] = next;
+                queue[tail++] = n;
+            }
+        }
+    }
+
+    int distance(int x, int y) const {
+        unsigned lx = x - originX, ly = y - originY;
+        if (lx >= (unsigned)FLOW_FIELD_SIZE || ly >= (unsigned)FLOW_FIELD_SIZE) return FLOW_UNREACHED;
+        return dist[ly * FLOW_FIELD_SIZE + lx];
+    }
+
+    // Direction (0 up, 1 down, 2 left, 3 right) of a neighbour one step
+    // closer to the diver, trying `first` and then the others in turn; -1
+    // when (x, y) is not in the field
+    int downhill(int x, int y, int first) const {
+        static const int dx[] = { 0, 0, -1, 1 };
+        static const int dy[] = { -1, 1, 0, 0 };
+        int here = distance(x, y);
+        if (here == FLOW_UNREACHED || here == 0) return -1;
+        for (int k = 0; k < 4; k++) {
+            int d = (first + k) & 3;
+            if (distance(x + dx[d], y + dy[d]) == here - 1) return d;
+        }
+        return -1;
+    }
+};
+
+/****************************************************/
+// Field Of View Class
+/****************************************************/
+// Tiles the diver can see from where they are: recursive shadowcasting over
+// the eight octants around the diver, with rock blocking sight. The result
+// is one bit per tile of a (2r+1)-square window kept until the diver moves
+// or a tile inside the window changes, so a query is a shift and a mask.
+// Slopes and the round edge of the radius are tabled once per radius.
+class FieldOfView {
+private:
+    int radius;
+    int side;
+    int originX, originY;   // Map position of the window's top-left tile
+    int sourceX, sourceY;
+    bool valid;
+    uint64_t rows[2 * MAX_FOV_RADIUS + 1];
+    // For each depth j and column k (k = 0 on the centre line): the slopes
+    // through the cell's corners, and how far each depth reaches sideways
+    vector<float> leftSlope, rightSlope;
+    vector<int> reach;
+    int computes;
+
+    void mark(int x, int y) {
+        rows[y - originY] |= 1ULL << (x - originX);
+    }
+
+    // Scans depth `row` onwards of one octant between two slopes; a run of
+    // rock narrows the slopes and the cells beyond it get their own scan.
+    // (xx, xy, yx, yy) turn octant coordinates into map offsets.
+    template <class Opaque>
+    void cast(int row, float start, float end, int xx, int xy, int yx, int yy, Opaque& opaque) {
+        if (start < end) return;
+        float newStart = 0.0f;
+        for (int j = row; j <= radius; j++) {
+            bool blocked = false;
+            for (int k = j; k >= 0; k--) {
+                // k counts down from the edge, so the scan runs start to end
+                float r = rightSlope[j * side + k];
+                float l = leftSlope[j * side + k];
+                if (start < r) continue;
+                if (end > l) break;
+                int dx = -k, dy = -j;
+                int mx = sourceX + dx * xx + dy * xy;
+                int my = sourceY + dx * yx + dy * yy;
+                if (k <= reach[j]) mark(mx, my);
+                bool wall = opaque(mx, my);
+                if (blocked) {
+                    if (wall) {
+                        newStart = r;
+                    } else {
+                        blocked = false;
+                        start = newStart;
+                    }
+                } else if (wall && j < radius) {
+                    blocked = true;
+                    cast(j + 1, start, l, xx, xy, yx, yy, opaque);
+                    newStart = r;
+                }
+            }
+            if (blocked) break;
+        }
+    }
+
+public:
+    explicit FieldOfView(int r = FOV_RADIUS)
+        : radius(r), side(2 * r + 1), originX(0), originY(0), sourceX(0), sourceY(0),
+          valid(false), leftSlope((r + 1) * side), rightSlope((r + 1) * side), reach(r + 1),
+          computes(0) {
+        for (int j = 0; j <= radius; j++) {
+            for (int k = 0; k <= j; k++) {
+                float dx = -k, dy = -j;
+                leftSlope[j * side + k] = (dx - 0.5f) / (dy + 0.5f);
+                rightSlope[j * side + k] = (dx + 0.5f) / (dy - 0.5f);
+            }
+            // r * (r + 1) rounds the circle's edge instead of leaving nubs
+            int k = 0;
+            while (k < j && j * j + (k + 1) * (k + 1) <= radius * (radius + 1)) k++;
+            reach[j] = k;
+        }
+    }
+
+    void invalidate() { valid = false; }
+    bool isFor(int x, int y) const { return valid && x == sourceX && y == sourceY; }
+
+    template <class Opaque>
+    void compute(int sx, int sy, Opaque opaque) {
+        // Each octant as (xx, xy, yx, yy)
+        static const int octants[8][4] = {
+            { 1, 0, 0, 1 }, { 0, 1, 1, 0 }, { 0, -1, 1, 0 }, { -1, 0, 0, 1 },
+            { -1, 0, 0, -1 }, { 0, -1, -1, 0 }, { 0, 1, -1, 0 }, { 1, 0, 0, -1 }
+        };
+        computes++;
+        originX = sx - radius;
+        originY = sy - radius;
+        sourceX = sx;
+        sourceY = sy;
+        valid = true;
+        memset(rows, 0, sizeof(rows));
+        mark(sx, sy);
+        for (int o = 0; o < 8; o++) {
+            cast(1, 1.0f, 0.0f, octants[o][0], octants[o][1], octants[o][2], octants[o][3], opaque);
+        }
+    }
+
+    bool visible(int x, int y) const {
+        unsigned lx = x - originX, ly = y - originY;
+        if (lx >= (unsigned)side || ly >= (unsigned)side) return false;
+        return (rows[ly] >> lx) & 1;
+    }
+
+    int computeCount() const { return computes; }
+};
+
+/****************************************************/
+// Local Window
+/****************************************************/
+// The game as the autopilot sees it: a PLAN_WINDOW square around the diver
+// copied out of the world once per decision. What actions cannot change
+// (terrain, where enemies and collectibles are) stays in the PlanWindow; what
+// they can is a PlanState of plain values, so a search copies a node with
+// one memcpy and steps it without touching the world. Enemies are taken to
+// hold still for the length of a plan; the plan is made again every tick.
+// A goal anywhere on the map pulls the plan along through the window, so
+// the diver keeps moving when nothing worth having is in view.
+enum PlanAction { PLAN_UP, PLAN_DOWN, PLAN_LEFT, PLAN_RIGHT,
+                  PLAN_LIGHT_UP, PLAN_LIGHT_DOWN, PLAN_LIGHT_LEFT, PLAN_LIGHT_RIGHT, PLAN_ACTIONS };
+const char PLAN_KEYS[PLAN_ACTIONS + 1] = "wsadikjl";
+
+struct PlanState {
+    int16_t x, y;               // Window coordinates
+    int16_t health, oxygen, battery;
+    int16_t explored;           // Tiles lit since the window was taken
+    int16_t idle;               // Actions that changed nothing
+    int32_t score;
+    int32_t risk;               // Damage courted next to chasing enemies
+    uint64_t taken;             // Bit per PlanWindow item picked up
+    uint64_t lit[PLAN_WINDOW * PLAN_WINDOW / 64];
+};
+
+static_assert(std::is_trivially_copyable<PlanState>::value, "plan states are copied by value");
+
+class PlanWindow {
+public:
+    enum { ROCK = 1, OFF_MAP = 2 };
+
+    int originX, originY;       // Map position of the window's top-left tile
+    uint8_t flags[PLAN_WINDOW * PLAN_WINDOW];
+    int16_t damage[PLAN_WINDOW * PLAN_WINDOW];   // Enemies standing on the tile
+    int16_t danger[PLAN_WINDOW * PLAN_WINDOW];   // Chasers on or next to it
+    int16_t wake[PLAN_WINDOW * PLAN_WINDOW];     // Dormant enemies lighting it wakes
+    int8_t item[PLAN_WINDOW * PLAN_WINDOW];      // Index into items, or -1
+    struct Item {
+        int16_t x, y;
+        char type;
+    };
+    Item items[PLAN_MAX_ITEMS];
+    int itemCount;
+    int32_t toGoal[PLAN_WINDOW * PLAN_WINDOW];   // Steps to the goal; see aim()
+    int goalItem;               // The goal's index into items, or -1
+
+    static int cell(int x, int y) { return y * PLAN_WINDOW + x; }
+
+    static bool isLit(const PlanState& s, int c) { return (s.lit[c >> 6] >> (c & 63)) & 1; }
+
+    static void light(PlanState& s, int c) {
+        if (isLit(s, c)) return;
+        s.lit[c >> 6] |= 1ULL << (c & 63);
+        s.explored++;
+    }
+
+    // Fills toGoal with the steps from each tile to the map position
+    // (goalX, goalY): through open water inside the window, then straight
+    // on from the window's edge. Tiles walled off from both stay at -1.
+    // A negative goalX clears the goal.
+    void aim(int goalX, int goalY) {
+        static const int dx[] = { 0, 0, -1, 1 };
+        static const int dy[] = { -1, 1, 0, 0 };
+        memset(toGoal, -1, sizeof(toGoal));
+        goalItem = -1;
+        if (goalX < 0) return;
+
+        // Sources: the goal itself and every open edge tile, at its
+        // straight-line distance, taken in distance order by the BFS
+        pair<int, int> seeds[4 * PLAN_WINDOW];  // The edge, the goal in it
+        int seedCount = 0;
+        for (int ly = 0; ly < PLAN_WINDOW; ly++) {
+            for (int lx = 0; lx < PLAN_WINDOW; lx++) {
+                int c = cell(lx, ly);
+                int along = abs(goalX - (originX + lx)) + abs(goalY - (originY + ly));
+                bool edge = lx == 0 || ly == 0 || lx == PLAN_WINDOW - 1 || ly == PLAN_WINDOW - 1;
+                if ((edge || along == 0) && !(flags[c] & ROCK)) seeds[seedCount++] = make_pair(along, c);
+                if (along == 0 && item[c] >= 0) goalItem = item[c];
+            }
+        }
+        sort(seeds, seeds + seedCount);
+        int queue[PLAN_WINDOW * PLAN_WINDOW];
+        int head = 0, tail = 0, nextSeed = 0;
+        while (nextSeed < seedCount || head < tail) {
+            int c;
+            if (nextSeed < seedCount && (head == tail || seeds[nextSeed].first <= toGoal[queue[head]])) {
+                c = seeds[nextSeed].second;
+                if (toGoal[c] >= 0) {
+                    nextSeed++;
+                    continue;
+                }
+                toGoal[c] = seeds[nextSeed++].first;
+            } else {
+                c = queue[head++];
+            }
+            int lx = c % PLAN_WINDOW, ly = c / PLAN_WINDOW;
+            for (int d = 0; d < 4; d++) {
+                unsigned nx = lx + dx[d], ny = ly + dy[d];
+                if (nx >= (unsigned)PLAN_WINDOW || ny >= (unsigned)PLAN_WINDOW) continue;
+                int n = cell(nx, ny);
+                if (toGoal[n] >= 0 || (flags[n] & ROCK)) continue;
+                toGoal[n] = toGoal[c] + 1;
+                queue[tail++] = n;
+            }
+        }
+    }
+
+    // Same rules as requestMove and illuminateTile for the diver. Bumping
+    // into rock or an enemy, lighting without battery and lighting a tile
+    // that is already lit count as idle.
+    void step(PlanState& s, int action) const {
+        static const int dx[] = { 0, 0, -1, 1 };
+        static const int dy[] = { -1, 1, 0, 0 };
+        int d = action & 3;
+        int c = cell(s.x + dx[d], s.y + dy[d]);
+        if (action < PLAN_LIGHT_UP) {
+            if (flags[c] & ROCK) {
+                s.oxygen = max(0, s.oxygen - 2);
+                s.idle++;
+                return;
+            }
+            if (damage[c]) {
+                s.health = max(0, s.health - damage[c]);
+                s.idle++;
+                return;
+            }
+            s.x += dx[d];
+            s.y += dy[d];
+            s.oxygen = max(0, s.oxygen - 2);
+            light(s, c);
+            s.risk += danger[c];
+            int i = item[c];
+            if (i >= 0 && !((s.taken >> i) & 1)) {
+                s.taken |= 1ULL << i;
+                if (items[i].type == COIN) {
+                    s.score += 50;
+                } else if (items[i].type == BATTERY_PACK) {
+                    s.battery = min(MAX_BATTERY, s.battery + 30);
+                    s.score += 20;
+                } else if (items[i].type == OXYGEN_TANK) {
+                    s.oxygen = min(MAX_OXYGEN, s.oxygen + 40);
+                    s.score += 20;
+                }
+            }
+        } else if (!(flags[c] & OFF_MAP) && s.battery >= BATTERY_COST) {
+            s.battery -= BATTERY_COST;
+            if (isLit(s, c)) {
+                s.idle++;
+            } else {
+                s.risk += wake[c];
+                light(s, c);
+            }
+        } else {
+            s.idle++;
+        }
+    }
+
+    // Higher is better. Score counts most; air is worth more the less is
+    // left; getting nearer the goal and new water break ties between lines
+    // that score the same, and standing still costs more than a step. A
+    // line out of air is only as bad as standing still from then on, so
+    // the diver spends the last of it going somewhere instead of parking.
+    int value(const PlanState& s) const {
+        if (s.health <= 0) return INT_MIN / 2 + s.score;
+        int v = s.score * 4 + s.explored * 6 + s.health * 4 + s.battery * 2 - s.risk * 4;
+        v += s.oxygen * 2 - max(0, 30 - s.oxygen) * 8 - s.idle * PLAN_IDLE_COST;
+        int togo = toGoal[cell(s.x, s.y)];
+        if (togo > 0 && !(goalItem >= 0 && ((s.taken >> goalItem) & 1))) v -= togo * PLAN_GOAL_STEP;
+        return v;
+    }
+};
+
+/****************************************************/
+// World Class
+/****************************************************/
+class World {
+private:
+    // Row-major grids sized by loadMap/createDefaultMap
+    int width, height;
+    vector<char> map;
+    FogMap illuminated;
+    Arena arena;  // Player and tile indices; rewound whenever a level starts
+    Player* player;
+    EnemyStore enemies;
+    int score;
+    
+    struct Collectible {
+        int x, y;
+        char type;
+        bool collected;
+    };
+    vector<Collectible> collectibles;
+
+    // Per-tile lookups for enemies and uncollected items
+    TileIndex enemyIndex;
+    TileIndex collectibleIndex;
+    vector<int> nearby;  // Scratch list for the sight-range scan
+
+    // Terrain of a streamed map, which replaces `map`; chunkBudget is 0 for
+    // fully resident maps
+    mutable ChunkCache chunks;
+    int chunkBudget;
+
+    bool streaming() const { return chunks.isOpen(); }
+
+    Rng rng[WORLD_RNG_STREAMS];
+    vector<char> pristine;   // Snapshot taken right after loading
+
+    // Moving enemies' proposed steps for the current tick
+    vector<int> targetX, targetY;
+    vector<unsigned char> wantsMove;
+    uint64_t tickKey;        // Drawn from RNG_AI once per tick
+    WorkerPool* workers;     // Optional; proposals run inline without it
+    FlowField chase;         // Paths to the diver for active enemies
+    mutable FieldOfView sight;  // What the diver sees; filled on first query
+
+    // Proposes a step for every active moving enemy in one chunk: downhill
+    // on the flow field towards the diver, or a random step when the diver
+    // is out of reach. Reads positions, terrain and the field only, so
+    // chunks can run on any thread in any order. Each roll hashes the tick
+    // key with the enemy's id instead of advancing a shared generator.
+    struct MoveProposals : ParallelTask {
+        World* world;
+        explicit MoveProposals(World* w) : world(w) {}
+        void run(int chunk) {
+            World& w = *world;
+            const EnemyBatch& b = w.enemies.batch(MOVING_ENEMY);
+            int end = min(b.size(), (chunk + 1) * ENEMY_CHUNK);
+            for (int i = chunk * ENEMY_CHUNK; i < end; i++) {
+                w.wantsMove[i] = 0;
+                if (!b.active[i]) continue;
+                uint64_t h = w.tickKey ^ ((uint64_t)i * 0x9E3779B97F4A7C15ULL);
+                h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+                h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+                h ^= h >> 31;
+                int roll = (int)(((h >> 32) * 12) >> 32);
+                if (roll < 4) continue;  // Skips a third of ticks
+                int newX = b.x[i], newY = b.y[i];
+                if (w.chase.distance(newX, newY) == 0) continue;  // Already on the diver
+                int dir = w.chase.downhill(newX, newY, roll & 3);
+                switch (dir >= 0 ? dir : roll & 3) {
+                    case 0: newY--; break;  // up
+                    case 1: newY++; break;  // down
+                    case 2: newX--; break;  // left
+                    case 3: newX++; break;  // right
+                }
+                if (w.canEnemyMoveTo(newX, newY)) {
+                    w.targetX[i] = newX;
+                    w.targetY[i] = newY;
+                    w.wantsMove[i] = 1;
+                }
+            }
+        }
+    };
+
+    // True once an earlier (lower id) moving enemy has stepped onto (x, y)
+    // this tick; an enemy that moved is at its target, which always
+    // differs from where it started
+    bool claimedThisTick(int x, int y) const {
+        for (int id = enemyIndex.first(x, y); id != TileIndex::NONE; id = enemyIndex.nextOf(id)) {
+            int j = 0;
+            if (enemies.locate(id, j) != MOVING_ENEMY) continue;
+            if (wantsMove[j] && targetX[j] == x && targetY[j] == y) return true;
+        }
+        return false;
+    }
+
+    // Terrain lookup for the diver and the renderer; pages chunks in
+    char tileAt(int x, int y) const {
+        return streaming() ? chunks.tile(x, y) : map[index(x, y)];
+    }
+
+    size_t index(int x, int y) const { return (size_t)y * width + x; }
+
+    bool inBounds(int x, int y) const {
+        return x >= 0 && x < width && y >= 0 && y < height;
+    }
+
+    // Starts a level from validated text rows: `nextRow` hands out each of
+    // the h rows in turn. Entity tiles become water once pulled out.
+    template <class NextRow>
+    void placeRows(int w, int h, int playerX, int playerY, NextRow nextRow) {
+        resize(w, h, 'o');
+        for (int y = 0; y < h; y++) {
+            char* row = &map[index(0, y)];
+            memcpy(row, nextRow(), w);
+            for (int x = plainPrefix(row, w); x < w; x++) {
+                char c = row[x];
+                if (c == 'x' || c == 'o') continue;
+                if (c == 'M') {
+                    // Randomly create stationary or moving enemy
+                    enemies.add(rng[RNG_SPAWN].below(2) == 0 ? STATIONARY_ENEMY : MOVING_ENEMY, x, y);
+                } else if (c != 'P') {
+                    collectibles.push_back({x, y, c, false});
+                }
+                row[x] = 'o';
+            }
+        }
+        player = arena.create(Player(playerX, playerY));
+        illuminated.set(playerX, playerY);  // Start position visible
+        finishLoad();
+    }
+
+    // Drops the previous level: its arena storage in one go, its enemies,
+    // items and score
+    void beginLevel() {
+        arena.rewind();
+        player = nullptr;
+        enemies.clear();
+        collectibles.clear();
+        score = 0;
+    }
+
+    void resize(int w, int h, char fill) {
+        beginLevel();
+        chunks.close();
+        chunkBudget = 0;
+        width = w;
+        height = h;
+        map.assign((size_t)w * h, fill);
+        illuminated.reset(w, h);
+    }
+
+    // Inserting in reverse keeps each tile's list in vector order
+    void buildIndices() {
+        chase.invalidate();
+        sight.invalidate();
+        enemies.renumber();
+        enemyIndex.reset(arena, width, height, enemies.size(), streaming());
+        for (int k = ENEMY_KIND_COUNT - 1; k >= 0; k--) {
+            const EnemyBatch& b = enemies.batch(k);
+            for (int i = b.size() - 1; i >= 0; i--) {
+                enemyIndex.insert(enemies.id(k, i), b.x[i], b.y[i]);
+            }
+        }
+        collectibleIndex.reset(arena, width, height, collectibles.size(), streaming());
+        for (int i = (int)collectibles.size() - 1; i >= 0; i--) {
+            if (!collectibles[i].collected) {
+                collectibleIndex.insert(i, collectibles[i].x, collectibles[i].y);
+            }
+        }
+    }
+
+    // Every way of starting a level ends here; reset() comes back to this.
+    // Terrain does not change during play, so the reset point skips it.
+    void finishLoad() {
+        buildIndices();
+        capture(pristine, false);
+    }
+
+    static bool badSnapshot(string& error, const string& what) {
+        error = "bad snapshot: " + what;
+        return false;
+    }
+
+public:
+    World() : width(0), height(0), player(nullptr), score(0), chunkBudget(0), tickKey(0), workers(nullptr) {
+        seed(1);
+    }
+
+    // Spreads enemy movement over a pool; results are the same either way
+    void setWorkers(WorkerPool* pool) { workers = pool; }
+
+    // Seeds level generation, spawns and enemy movement; call before
+    // loading to fix the level, or after it to replay different enemies
+    void seed(uint64_t value) {
+        for (int i = 0; i < WORLD_RNG_STREAMS; i++) rng[i].seed(value, i);
+    }
+
+    // Loads a text map: one row per line (LF or CRLF), all rows the same
+    // width, exactly one 'P'. Tiles are 'x' rock and 'o' water, with 'M'
+    // enemies and '*' 'B' 'O' items placed on water. "default" generates the
+    // built-in map instead and "level:NAME" loads a bundled level. On
+    // failure the world is left untouched and `error` says what is wrong
+    // and where.
+    bool loadMap(const string& filepath, string& error) {
+        if (filepath == "default") {
+            createDefaultMap();
+            return true;
+        }
+        if (filepath.compare(0, 6, "level:") == 0) {
+            const EmbeddedLevel* level = findLevel(filepath.substr(6));
+            if (!level) {
+                error = "no bundled level '" + filepath.substr(6) + "' (levels:";
+                for (int i = 0; i < BUNDLED_LEVEL_COUNT; i++) error += string(" ") + BUNDLED_LEVELS[i].name;
+                error += ")";
+                return false;
+            }
+            loadLevel(*level);
+            return true;
+        }
+
+        MappedFile file;
+        if (!file.open(filepath, error)) return false;
+        if (is_binary_map(file)) return loadBinaryMap(file, filepath, error);
+        const char* data = file.data();
+        const char* end = data + file.size();
+
+        // Pass 1: split lines, infer the size and validate every byte
+        int w = -1, h = 0;
+        int playerX = -1, playerY = -1;
+        for (const char* line = data; line < end; h++) {
+            const char* nl = (const char*)memchr(line, '\n', end - line);
+            const char* lineEnd = nl ? nl : end;
+            const char* next = nl ? nl + 1 : end;
+            if (lineEnd > line && lineEnd[-1] == '\r') lineEnd--;
+            long long len = lineEnd - line;
+
+            if (w < 0) {
+                if (len == 0) return fail(error, filepath, h, -1, "first row is empty");
+                if (len > INT_MAX) return fail(error, filepath, h, -1, "row is too long");
+                w = len;
+            } else if (len == 0 && next == end) {
+                break;  // Blank last line
+            } else if (len != w) {
+                char msg[96];
+                snprintf(msg, sizeof(msg), "expected %d columns like the first row, found %lld", w, len);
+                return fail(error, filepath, h, -1, msg);
+            }
+
+            for (int x = plainPrefix(line, w); x < w; x++) {
+                char c = line[x];
+                if (c == 'x' || c == 'o') continue;
+                if (c == 'P') {
+                    if (playerX >= 0) {
+                        char msg[96];
+                        snprintf(msg, sizeof(msg), "second player start 'P' (first at line %d, column %d)",
+                                 playerY + 1, playerX + 1);
+                        return fail(error, filepath, h, x, msg);
+                    }
+                    playerX = x;
+                    playerY = h;
+                } else if (c != 'M' && c != COIN && c != BATTERY_PACK && c != OXYGEN_TANK) {
+                    char msg[64];
+                    if (isprint((unsigned char)c)) {
+                        snprintf(msg, sizeof(msg), "unexpected tile '%c'", c);
+                    } else {
+                        snprintf(msg, sizeof(msg), "unexpected byte 0x%02x", (unsigned char)c);
+                    }
+                    return fail(error, filepath, h, x, msg);
+                }
+            }
+            line = next;
+        }
+        if (h == 0) return fail(error, filepath, -1, -1, "map is empty");
+        if (playerX < 0) return fail(error, filepath, -1, -1, "no player start 'P'");
+
+        // Pass 2: copy rows into the grid and pull out the entities
+        const char* line = data;
+        placeRows(w, h, playerX, playerY, [&line, end]() {
+            const char* row = line;
+            const char* nl = (const char*)memchr(line, '\n', end - line);
+            line = nl ? nl + 1 : end;
+            return row;
+        });
+        return true;
+    }
+
+    // Loads a level compiled into the program. It was checked when the
+    // program was built, so this only copies rows.
+    void loadLevel(const EmbeddedLevel& level) {
+        const char* row = level.rows;
+        int stride = level.width + 1;
+        placeRows(level.width, level.height, level.playerX, level.playerY, [&row, stride]() {
+            const char* current = row;
+            row += stride;
+            return current;
+        });
+    }
+
+    static const EmbeddedLevel* findLevel(const string& name) {
+        for (int i = 0; i < BUNDLED_LEVEL_COUNT; i++) {
+            if (name == BUNDLED_LEVELS[i].name) return &BUNDLED_LEVELS[i];
+        }
+        return nullptr;
+    }
+
+    // Checks a binary map's header and that every section fits in the file
+    bool readBinaryHeader(const MappedFile& file, const string& filepath, BinaryMapHeader& header, string& error) {
+        if (file.size() < sizeof(header)) return fail(error, filepath, -1, -1, "truncated header");
+        memcpy(&header, file.data(), sizeof(header));
+        if (header.version != BINARY_MAP_VERSION) {
+            char msg[64];
+            snprintf(msg, sizeof(msg), "unsupported binary map version %u", header.version);
+            return fail(error, filepath, -1, -1, msg);
+        }
+
+        uint64_t w = header.width, h = header.height;
+        if (w == 0 || h == 0 || w > INT_MAX || h > INT_MAX) {
+            return fail(error, filepath, -1, -1, "bad map dimensions");
+        }
+        uint64_t enemyBytes = 0;
+        for (int k = 0; k < ENEMY_KIND_COUNT; k++) enemyBytes += 3 * sizeof(int32_t) * (uint64_t)header.enemyCount[k];
+        uint64_t collectibleBytes = sizeof(BinaryCollectible) * (uint64_t)header.collectibleCount;
+        uint64_t size = file.size();
+        if (header.tilesOffset > size || w * h > size - header.tilesOffset ||
+            header.enemiesOffset > size || enemyBytes > size - header.enemiesOffset ||
+            header.collectiblesOffset > size || collectibleBytes > size - header.collectiblesOffset) {
+            return fail(error, filepath, -1, -1, "section extends past the end of the file");
+        }
+        if ((header.tilesOffset | header.enemiesOffset | header.collectiblesOffset) & 7) {
+            return fail(error, filepath, -1, -1, "section is not 8-byte aligned");
+        }
+        if (header.playerX >= w || header.playerY >= h) {
+            return fail(error, filepath, -1, -1, "player start is outside the map");
+        }
+        return true;
+    }
+
+    // Checks the entity tables without touching the world. Like the text
+    // loader, every enemy and item must sit on open water.
+    bool checkBinaryEntities(const MappedFile& file, const string& filepath, const BinaryMapHeader& header,
+                             string& error) const {
+        const char* tiles = file.data() + header.tilesOffset;
+        uint64_t w = header.width;
+        const char* section = file.data() + header.enemiesOffset;
+        const int32_t* packed[ENEMY_KIND_COUNT][3];
+        for (int k = 0; k < ENEMY_KIND_COUNT; k++) {
+            for (int field = 0; field < 3; field++) {
+                packed[k][field] = (const int32_t*)section;
+                section += sizeof(int32_t) * header.enemyCount[k];
+            }
+            for (uint32_t i = 0; i < header.enemyCount[k]; i++) {
+                uint32_t x = packed[k][0][i], y = packed[k][1][i];
+                if (x >= header.width || y >= header.height) {
+                    return fail(error, filepath, -1, -1, "enemy outside the map");
+                }
+                if (tiles[y * w + x] != 'o') return fail(error, filepath, -1, -1, "enemy on rock");
+            }
+        }
+        const BinaryCollectible* items = (const BinaryCollectible*)(file.data() + header.collectiblesOffset);
+        for (uint32_t i = 0; i < header.collectibleCount; i++) {
+            if ((uint32_t)items[i].x >= header.width || (uint32_t)items[i].y >= header.height ||
+                (items[i].type != COIN && items[i].type != BATTERY_PACK && items[i].type != OXYGEN_TANK)) {
+                return fail(error, filepath, -1, -1, "bad collectible record");
+            }
+            if (tiles[items[i].y * w + items[i].x] != 'o') {
+                return fail(error, filepath, -1, -1, "collectible on rock");
+            }
+        }
+        return true;
+    }
+
+    // Copies checked entity tables straight into the enemy batches and items
+    void copyBinaryEntities(const MappedFile& file, const BinaryMapHeader& header) {
+        const char* section = file.data() + header.enemiesOffset;
+        for (int k = 0; k < ENEMY_KIND_COUNT; k++) {
+            const int32_t* packed = (const int32_t*)section;
+            uint32_t n = header.enemyCount[k];
+            enemies.batch(k).assign(packed, packed + n, packed + 2 * n, n);
+            section += 3 * sizeof(int32_t) * n;
+        }
+        const BinaryCollectible* items = (const BinaryCollectible*)(file.data() + header.collectiblesOffset);
+        collectibles.resize(header.collectibleCount);
+        for (uint32_t i = 0; i < header.collectibleCount; i++) {
+            Collectible col = { items[i].x, items[i].y, items[i].type, false };
+            collectibles[i] = col;
+        }
+    }
+
+    // Loads a converted map (see Binary Map Format). Every count, offset and
+    // coordinate is checked against the file before anything is copied.
+    bool loadBinaryMap(const MappedFile& file, const string& filepath, string& error) {
+        BinaryMapHeader header;
+        if (!readBinaryHeader(file, filepath, header, error)) return false;
+        uint64_t w = header.width, h = header.height;
+        const char* tiles = file.data() + header.tilesOffset;
+        for (uint64_t y = 0; y < h; y++) {
+            const char* row = tiles + y * w;
+            if (plainPrefix(row, w) < (int)w) {
+                for (uint64_t x = 0; x < w; x++) {
+                    if (row[x] != 'x' && row[x] != 'o') {
+                        return fail(error, filepath, -1, -1, "tile grid holds something other than 'x' and 'o'");
+                    }
+                }
+            }
+        }
+        if (tiles[header.playerY * w + header.playerX] != 'o') {
+            return fail(error, filepath, -1, -1, "player start is not on open water");
+        }
+        if (!checkBinaryEntities(file, filepath, header, error)) return false;
+
+        resize(w, h, 'o');
+        memcpy(map.data(), tiles, w * h);
+        copyBinaryEntities(file, header);
+        player = arena.create(Player(header.playerX, header.playerY));
+        illuminated.set(header.playerX, header.playerY);  // Start position visible
+        finishLoad();
+        return true;
+    }
+
+    // Opens a binary map for streaming: only the entity tables are read up
+    // front, and terrain is paged in chunk by chunk as the diver swims, with
+    // at most `chunkBudget` chunks resident. Fog and tile indices are sparse,
+    // so memory follows what has been explored, not the size of the map.
+    bool streamMap(const string& filepath, int budget, string& error) {
+        MappedFile file;
+        if (!file.open(filepath, error)) return false;
+        if (!is_binary_map(file)) {
+            return fail(error, filepath, -1, -1, "streaming needs a binary map (see --convert)");
+        }
+        BinaryMapHeader header;
+        if (!readBinaryHeader(file, filepath, header, error)) return false;
+        if (!chunks.open(filepath, header, budget, error)) return false;
+        if (chunks.tile(header.playerX, header.playerY) != 'o') {
+            chunks.close();
+            return fail(error, filepath, -1, -1, "player start is not on open water");
+        }
+        if (!checkBinaryEntities(file, filepath, header, error)) {
+            chunks.close();
+            return false;
+        }
+
+        beginLevel();
+        copyBinaryEntities(file, header);
+        width = header.width;
+        height = header.height;
+        map.clear();
+        illuminated.reset(width, height);
+        chunkBudget = budget;
+        player = arena.create(Player(header.playerX, header.playerY));
+        illuminated.set(header.playerX, header.playerY);  // Start position visible
+        chunks.prefetch(header.playerX, header.playerY, 1);
+        finishLoad();
+        return true;
+    }
+
+    // Replaces `out` with the complete game state (see Snapshot Format),
+    // with the tile grid unless `withTiles` is false or the map is streamed
+    void capture(vector<char>& out, bool withTiles) const {
+        withTiles = withTiles && !streaming();
+        SnapshotHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.version = SNAPSHOT_VERSION;
+        header.flags = withTiles ? SNAPSHOT_HAS_TILES : 0;
+        header.width = width;
+        header.height = height;
+        header.score = score;
+        for (int i = 0; i < WORLD_RNG_STREAMS; i++) rng[i].save(header.rng[i]);
+        header.playerX = player->getX();
+        header.playerY = player->getY();
+        header.health = player->getHealth();
+        header.oxygen = player->getOxygen();
+        header.battery = player->getBattery();
+        header.lives = player->getLives();
+        for (int k = 0; k < ENEMY_KIND_COUNT; k++) header.enemyCount[k] = enemies.batch(k).size();
+        header.collectibleCount = collectibles.size();
+
+        size_t bytes = align8(sizeof(header)) + (withTiles ? align8(map.size()) : 0) +
+                       align8(collectibles.size() * sizeof(SavedCollectible)) +
+                       illuminated.blockCount() * sizeof(SavedFogBlock);
+        for (int k = 0; k < ENEMY_KIND_COUNT; k++) bytes += align8(14 * (size_t)header.enemyCount[k]);
+        out.clear();
+        out.reserve(bytes);
+        snapshot_put(out, &header, sizeof(header));
+        if (withTiles) {
+            snapshot_put(out, map.data(), map.size());
+            snapshot_align(out);
+        }
+        for (int k = 0; k < ENEMY_KIND_COUNT; k++) {
+            const EnemyBatch& b = enemies.batch(k);
+            snapshot_put(out, b.x.data(), sizeof(int32_t) * b.size());
+            snapshot_put(out, b.y.data(), sizeof(int32_t) * b.size());
+            snapshot_put(out, b.damage.data(), sizeof(int32_t) * b.size());
+            snapshot_put(out, b.active.data(), b.size());
+            snapshot_put(out, b.visible.data(), b.size());
+            snapshot_align(out);
+        }
+        for (size_t i = 0; i < collectibles.size(); i++) {
+            SavedCollectible rec = { collectibles[i].x, collectibles[i].y, collectibles[i].type,
+                                     collectibles[i].collected, { 0, 0 } };
+            snapshot_put(out, &rec, sizeof(rec));
+        }
+        snapshot_align(out);
+        uint32_t fogBlocks = illuminated.save(out);
+        memcpy(&out[offsetof(SnapshotHeader, fogBlockCount)], &fogBlocks, sizeof(fogBlocks));
+    }
+
+    // Puts the world back into a captured state. Snapshots without tiles
+    // only restore onto the same map, already loaded or streamed.
+    // Everything is checked first; on failure the world is left untouched.
+    bool restore(const char* data, size_t size, string& error) {
+        SnapshotReader in(data, size);
+        SnapshotHeader header;
+        const char* p = in.take(sizeof(header));
+        if (!p) return badSnapshot(error, "truncated header");
+        memcpy(&header, p, sizeof(header));
+        if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) {
+            return badSnapshot(error, "not a save game");
+        }
+        if (header.version != SNAPSHOT_VERSION) return badSnapshot(error, "unsupported version");
+        if (header.width == 0 || header.height == 0 || header.width > INT_MAX || header.height > INT_MAX) {
+            return badSnapshot(error, "bad map dimensions");
+        }
+        uint64_t w = header.width, h = header.height;
+
+        // Terrain: either carried in the snapshot or the streamed map's
+        const char* tiles = nullptr;
+        if (header.flags & SNAPSHOT_HAS_TILES) {
+            tiles = in.take(w * h);
+            if (!tiles) return badSnapshot(error, "truncated tiles");
+            in.align();
+            for (uint64_t y = 0; y < h; y++) {
+                const char* row = tiles + y * w;
+                for (int x = plainPrefix(row, w); x < (int)w; x++) {
+                    if (row[x] != 'x' && row[x] != 'o') return badSnapshot(error, "bad tile");
+                }
+            }
+        } else if (!player || (uint64_t)width != w || (uint64_t)height != h) {
+            return badSnapshot(error, "saved on a streamed map; resume it with the same --map and --stream");
+        }
+        if ((uint32_t)header.playerX >= w || (uint32_t)header.playerY >= h ||
+            (tiles ? tiles[header.playerY * w + header.playerX] : tileAt(header.playerX, header.playerY)) != 'o') {
+            return badSnapshot(error, "diver is not on open water");
+        }
+        if (header.health < 0 || header.health > MAX_HEALTH || header.oxygen < 0 || header.oxygen > MAX_OXYGEN ||
+            header.battery < 0 || header.battery > MAX_BATTERY) {
+            return badSnapshot(error, "diver stats out of range");
+        }
+
+        const char* batches[ENEMY_KIND_COUNT];
+        for (int k = 0; k < ENEMY_KIND_COUNT; k++) {
+            uint64_t n = header.enemyCount[k];
+            batches[k] = in.take(n * (3 * sizeof(int32_t) + 2));
+            if (!batches[k]) return badSnapshot(error, "truncated enemies");
+            in.align();
+            for (uint64_t i = 0; i < n; i++) {
+                int32_t x, y;
+                memcpy(&x, batches[k] + i * sizeof(int32_t), sizeof(x));
+                memcpy(&y, batches[k] + (n + i) * sizeof(int32_t), sizeof(y));
+                const char* flags = batches[k] + 3 * n * sizeof(int32_t);
+                if ((uint32_t)x >= w || (uint32_t)y >= h || (unsigned char)flags[i] > 1 ||
+                    (unsigned char)flags[n + i] > 1) {
+                    return badSnapshot(error, "bad enemy record");
+                }
+            }
+        }
+        const char* items = in.take((uint64_t)header.collectibleCount * sizeof(SavedCollectible));
+        if (!items) return badSnapshot(error, "truncated collectibles");
+        for (uint32_t i = 0; i < header.collectibleCount; i++) {
+            SavedCollectible rec;
+            memcpy(&rec, items + i * sizeof(rec), sizeof(rec));
+            if ((uint32_t)rec.x >= w || (uint32_t)rec.y >= h || (unsigned char)rec.collected > 1 ||
+                (rec.type != COIN && rec.type != BATTERY_PACK && rec.type != OXYGEN_TANK)) {
+                return badSnapshot(error, "bad collectible record");
+            }
+        }
+        in.align();
+        const SavedFogBlock* fog =
+            (const SavedFogBlock*)in.take((uint64_t)header.fogBlockCount * sizeof(SavedFogBlock));
+        if (!fog) return badSnapshot(error, "truncated fog");
+        if (!FogMap::check(w, h, fog, header.fogBlockCount)) return badSnapshot(error, "fog outside the map");
+
+        // Checked; now apply
+        if (tiles) {
+            resize(w, h, 'o');
+            memcpy(map.data(), tiles, w * h);
+        } else {
+            beginLevel();
+            illuminated.reset(w, h);
+        }
+        illuminated.load(fog, header.fogBlockCount);
+        for (int k = 0; k < ENEMY_KIND_COUNT; k++) {
+            uint32_t n = header.enemyCount[k];
+            const int32_t* fields = (const int32_t*)batches[k];
+            EnemyBatch& b = enemies.batch(k);
+            b.assign(fields, fields + n, fields + 2 * n, n);
+            const unsigned char* flags = (const unsigned char*)(fields + 3 * n);
+            b.active.assign(flags, flags + n);
+            b.visible.assign(flags + n, flags + 2 * n);
+        }
+        collectibles.resize(header.collectibleCount);
+        for (uint32_t i = 0; i < header.collectibleCount; i++) {
+            SavedCollectible rec;
+            memcpy(&rec, items + i * sizeof(rec), sizeof(rec));
+            Collectible col = { rec.x, rec.y, rec.type, rec.collected != 0 };
+            collectibles[i] = col;
+        }
+        player = arena.create(Player(header.playerX, header.playerY, header.health, header.oxygen,
+                                     header.battery, header.lives));
+        score = header.score;
+        for (int i = 0; i < WORLD_RNG_STREAMS; i++) rng[i].load(header.rng[i]);
+        buildIndices();
+        return true;
+    }
+
+    // Writes the current state as a save game
+    bool saveGame(const string& filepath, string& error) const {
+        vector<char> snapshot;
+        capture(snapshot, true);
+        FILE* out = fopen(filepath.c_str(), "wb");
+        if (!out) {
+            error = filepath + ": " + strerror(errno);
+            return false;
+        }
+        fwrite(snapshot.data(), 1, snapshot.size(), out);
+        if (ferror(out) | fclose(out)) {
+            error = filepath + ": write failed";
+            return false;
+        }
+        return true;
+    }
+
+    // Resumes a save game; resetting afterwards returns to the saved state
+    bool loadGame(const string& filepath, string& error) {
+        MappedFile file;
+        if (!file.open(filepath, error)) return false;
+        if (!restore(file.data(), file.size(), error)) {
+            error = filepath + ": " + error;
+            return false;
+        }
+        pristine.assign(file.data(), file.data() + file.size());
+        return true;
+    }
+
+    // Writes the freshly loaded world in the binary map format
+    bool saveBinaryMap(const string& filepath, string& error) const {
+        if (streaming()) {
+            error = "a streamed map is already in binary form";
+            return false;
+        }
+        BinaryMapHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, BINARY_MAP_MAGIC, sizeof(header.magic));
+        header.version = BINARY_MAP_VERSION;
+        header.width = width;
+        header.height = height;
+        header.playerX = player->getX();
+        header.playerY = player->getY();
+        header.tilesOffset = align8(sizeof(header));
+        header.enemiesOffset = align8(header.tilesOffset + map.size());
+        uint64_t end = header.enemiesOffset;
+        for (int k = 0; k < ENEMY_KIND_COUNT; k++) {
+            header.enemyCount[k] = enemies.batch(k).size();
+            end += 3 * sizeof(int32_t) * header.enemyCount[k];
+        }
+        header.collectibleCount = 0;
+        for (size_t i = 0; i < collectibles.size(); i++) header.collectibleCount += !collectibles[i].collected;
+        header.collectiblesOffset = align8(end);
+
+        FILE* out = fopen(filepath.c_str(), "wb");
+        if (!out) {
+            error = filepath + ": " + strerror(errno);
+            return false;
+        }
+        static const char zeros[8] = { 0 };
+        fwrite(&header, sizeof(header), 1, out);
+        fwrite(zeros, 1, header.tilesOffset - sizeof(header), out);
+        fwrite(map.data(), 1, map.size(), out);
+        fwrite(zeros, 1, header.enemiesOffset - header.tilesOffset - map.size(), out);
+        for (int k = 0; k < ENEMY_KIND_COUNT; k++) {
+            const EnemyBatch& b = enemies.batch(k);
+            fwrite(b.x.data(), sizeof(int32_t), b.size(), out);
+            fwrite(b.y.data(), sizeof(int32_t), b.size(), out);
+            fwrite(b.damage.data(), sizeof(int32_t), b.size(), out);
+        }
+        fwrite(zeros, 1, header.collectiblesOffset - end, out);
+        for (size_t i = 0; i < collectibles.size(); i++) {
+            if (collectibles[i].collected) continue;
+            BinaryCollectible rec = { collectibles[i].x, collectibles[i].y, collectibles[i].type, { 0, 0, 0 } };
+            fwrite(&rec, sizeof(rec), 1, out);
+        }
+        if (ferror(out) | fclose(out)) {
+            error = filepath + ": write failed";
+            return false;
+        }
+        return true;
+    }
+
+    // Length of the leading run of plain 'x'/'o' tiles, checked 8 bytes at a
+    // time since most rows contain nothing else
+    static int plainPrefix(const char* row, int w) {
+        const uint64_t ones = 0x0101010101010101ULL;
+        const uint64_t low7 = ones * 0x7F, high = ones * 0x80;
+        int x = 0;
+        for (; x + 8 <= w; x += 8) {
+            uint64_t v;
+            memcpy(&v, row + x, 8);
+            // Exact per-byte zero test: the high bit survives only for zero bytes
+            uint64_t isX = v ^ (ones * 'x');
+            uint64_t isO = v ^ (ones * 'o');
+            uint64_t zeroX = ~(((isX & low7) + low7) | isX) & high;
+            uint64_t zeroO = ~(((isO & low7) + low7) | isO) & high;
+            if ((zeroX | zeroO) != high) break;
+        }
+        return x;
+    }
+
+    // Formats "path:line:column: message"; line and column are 0-based, -1 to omit
+    static bool fail(string& error, const string& path, int line, int column, const char* message) {
+        char where[32] = "";
+        if (line >= 0 && column >= 0) {
+            snprintf(where, sizeof(where), "%d:%d:", line + 1, column + 1);
+        } else if (line >= 0) {
+            snprintf(where, sizeof(where), "%d:", line + 1);
+        }
+        error = path + ":" + where + " " + message;
+        return false;
+    }
+
+    void createDefaultMap() {
+        // Fill with walls on edges, empty inside
+        resize(DEFAULT_MAP_WIDTH, DEFAULT_MAP_HEIGHT, 'o');
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                if (y == 0 || y == height - 1 || x == 0 || x == width - 1) {
+                    map[index(x, y)] = 'x';
+                }
+            }
+        }
+        
+        // Add more obstacles for interesting layout
+        for (int i = 0; i < 25; i++) {
+            int x = 2 + rng[RNG_MAP].below(width - 4);
+            int y = 2 + rng[RNG_MAP].below(height - 4);
+            map[index(x, y)] = 'x';
+        }
+
+        // Create player
+        player = arena.create(Player(5, 5));
+        illuminated.set(5, 5);
+
+        // Add many more enemies (mix of stationary and moving)
+        for (int i = 0; i < 15; i++) {
+            int x = 2 + rng[RNG_SPAWN].below(width - 4);
+            int y = 2 + rng[RNG_SPAWN].below(height - 4);
+            if (map[index(x, y)] == 'o' && !(x == 5 && y == 5)) {
+                // 1/3 chance stationary
+                enemies.add(rng[RNG_SPAWN].below(3) == 0 ? STATIONARY_ENEMY : MOVING_ENEMY, x, y);
+            }
+        }
+        
+        // Spawn collectibles (coins, battery packs, oxygen tanks)
+        spawnCollectibles();
+        finishLoad();
+    }
+
+    void spawnCollectibles() {
+        // Spawn 10-15 coins
+        for (int i = 0; i < 10 + rng[RNG_SPAWN].below(6); i++) {
+            int x = 1 + rng[RNG_SPAWN].below(width - 2);
+            int y = 1 + rng[RNG_SPAWN].below(height - 2);
+            if (map[index(x, y)] == 'o') {
+                collectibles.push_back({x, y, COIN, false});
+            }
+        }
+        
+        // Spawn 3-5 battery packs
+        for (int i = 0; i < 3 + rng[RNG_SPAWN].below(3); i++) {
+            int x = 1 + rng[RNG_SPAWN].below(width - 2);
+            int y = 1 + rng[RNG_SPAWN].below(height - 2);
+            if (map[index(x, y)] == 'o') {
+                collectibles.push_back({x, y, BATTERY_PACK, false});
+            }
+        }
+        
+        // Spawn 3-5 oxygen tanks
+        for (int i = 0; i < 3 + rng[RNG_SPAWN].below(3); i++) {
+            int x = 1 + rng[RNG_SPAWN].below(width - 2);
+            int y = 1 + rng[RNG_SPAWN].below(height - 2);
+            if (map[index(x, y)] == 'o') {
+                collectibles.push_back({x, y, OXYGEN_TANK, false});
+            }
+        }
+    }
+
+    // Procedural dive site for stress runs: walled border, scattered rocks,
+    // the diver in the middle and the requested number of enemies and items
+    void createRandomMap(int w, int h, int enemyCount, int collectibleCount) {
+        resize(w, h, 'o');
+        for (int x = 0; x < w; x++) {
+            map[index(x, 0)] = 'x';
+            map[index(x, h - 1)] = 'x';
+        }
+        for (int y = 0; y < h; y++) {
+            map[index(0, y)] = 'x';
+            map[index(w - 1, y)] = 'x';
+        }
+        for (long long i = 0; i < (long long)w * h / 16; i++) {
+            int x = 1 + rng[RNG_MAP].below(w - 2);
+            map[index(x, 1 + rng[RNG_MAP].below(h - 2))] = 'x';
+        }
+
+        int px = w / 2, py = h / 2;
+        map[index(px, py)] = 'o';
+        player = arena.create(Player(px, py));
+        illuminated.set(px, py);
+
+        static const char itemTypes[] = { COIN, COIN, BATTERY_PACK, OXYGEN_TANK };
+        for (int placed = 0; placed < enemyCount + collectibleCount; ) {
+            int x = 1 + rng[RNG_SPAWN].below(w - 2);
+            int y = 1 + rng[RNG_SPAWN].below(h - 2);
+            if (map[index(x, y)] != 'o' || (x == px && y == py)) continue;
+            if (placed < enemyCount) {
+                enemies.add(rng[RNG_SPAWN].below(3) == 0 ? STATIONARY_ENEMY : MOVING_ENEMY, x, y);
+            } else {
+                collectibles.push_back({x, y, itemTypes[rng[RNG_SPAWN].below(4)], false});
+            }
+            placed++;
+        }
+        finishLoad();
+    }
+
+    // The diver's field of view, cast again only once they have moved.
+    // Rock, the map edge and chunks that are not resident block sight;
+    // nothing is paged in to look.
+    const FieldOfView& fov() const {
+        int px = player->getX(), py = player->getY();
+        if (!sight.isFor(px, py)) {
+            sight.compute(px, py, [this](int x, int y) { return !canEnemyMoveTo(x, y); });
+        }
+        return sight;
+    }
+
+    bool canSee(int x, int y) const { return fov().visible(x, y); }
+
+    // Copies the PLAN_WINDOW square around the diver out for the autopilot.
+    // Tiles off the map or in chunks that are not resident count as rock.
+    void takeWindow(PlanWindow& w, PlanState& s) const {
+        int px = player->getX(), py = player->getY();
+        w.originX = px - PLAN_WINDOW / 2;
+        w.originY = py - PLAN_WINDOW / 2;
+        memset(&s, 0, sizeof(s));
+        s.x = PLAN_WINDOW / 2;
+        s.y = PLAN_WINDOW / 2;
+        s.health = player->getHealth();
+        s.oxygen = player->getOxygen();
+        s.battery = player->getBattery();
+        s.score = score;
+
+        memset(w.damage, 0, sizeof(w.damage));
+        memset(w.danger, 0, sizeof(w.danger));
+        memset(w.wake, 0, sizeof(w.wake));
+        memset(w.item, -1, sizeof(w.item));
+        for (int ly = 0; ly < PLAN_WINDOW; ly++) {
+            for (int lx = 0; lx < PLAN_WINDOW; lx++) {
+                int x = w.originX + lx, y = w.originY + ly;
+                int c = PlanWindow::cell(lx, ly);
+                if (!inBounds(x, y)) {
+                    w.flags[c] = PlanWindow::ROCK | PlanWindow::OFF_MAP;
+                    continue;
+                }
+                w.flags[c] = canEnemyMoveTo(x, y) ? 0 : PlanWindow::ROCK;
+                if (illuminated.test(x, y)) s.lit[c >> 6] |= 1ULL << (c & 63);
+                for (int e = enemyIndex.first(x, y); e != TileIndex::NONE; e = enemyIndex.nextOf(e)) {
+                    int i = 0;
+                    int kind = enemies.locate(e, i);
+                    const EnemyBatch& b = enemies.batch(kind);
+                    w.damage[c] += b.damage[i];
+                    if (!b.active[i]) {
+                        w.wake[c] += b.damage[i];
+                    } else if (kind == MOVING_ENEMY) {
+                        // A chaser reaches its own tile and the four around it
+                        static const int dx[] = { 0, 0, 0, -1, 1 };
+                        static const int dy[] = { 0, -1, 1, 0, 0 };
+                        for (int d = 0; d < 5; d++) {
+                            unsigned nx = lx + dx[d], ny = ly + dy[d];
+                            if (nx < (unsigned)PLAN_WINDOW && ny < (unsigned)PLAN_WINDOW) {
+                                w.danger[PlanWindow::cell(nx, ny)] += b.damage[i];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        // Collectibles nearest the diver first, in rings, while bits last
+        w.itemCount = 0;
+        for (int r = 0; r < PLAN_WINDOW / 2; r++) {
+            for (int ly = s.y - r; ly <= s.y + r; ly++) {
+                int stride = (r == 0 || ly == s.y - r || ly == s.y + r) ? 1 : 2 * r;
+                for (int lx = s.x - r; lx <= s.x + r; lx += stride) {
+                    int x = w.originX + lx, y = w.originY + ly;
+                    if (!inBounds(x, y) || w.itemCount == PLAN_MAX_ITEMS) continue;
+                    int c = collectibleIndex.first(x, y);
+                    if (c == TileIndex::NONE) continue;
+                    PlanWindow::Item item = { (int16_t)lx, (int16_t)ly, collectibles[c].type };
+                    w.item[PlanWindow::cell(lx, ly)] = w.itemCount;
+                    w.items[w.itemCount++] = item;
+                }
+            }
+        }
+    }
+
+    // The uncollected collectible nearest the diver in straight-line steps,
+    // of `type` or of any type when it is 0, passing over those flagged in
+    // `skip`; -1 when there is none
+    int nearestCollectible(char type, const vector<uint8_t>& skip) const {
+        int px = player->getX(), py = player->getY();
+        int best = -1, bestSteps = INT_MAX;
+        for (int i = 0; i < (int)collectibles.size(); i++) {
+            const Collectible& c = collectibles[i];
+            if (c.collected || (type && c.type != type) || (i < (int)skip.size() && skip[i])) continue;
+            int steps = abs(c.x - px) + abs(c.y - py);
+            if (steps < bestSteps) {
+                best = i;
+                bestSteps = steps;
+            }
+        }
+        return best;
+    }
+
+    // Where collectible `i` lies; false once it has been picked up
+    bool collectibleAt(int i, int& x, int& y, char& type) const {
+        if (i < 0 || i >= (int)collectibles.size() || collectibles[i].collected) return false;
+        x = collectibles[i].x;
+        y = collectibles[i].y;
+        type = collectibles[i].type;
+        return true;
+    }
+
+    bool canMoveTo(int x, int y) const {
+        if (!inBounds(x, y)) return false;
+        return tileAt(x, y) != 'x';
+    }
+
+    // Enemies never page terrain in: in chunks that are not resident they
+    // stay frozen until the diver comes back
+    bool canEnemyMoveTo(int x, int y) const {
+        if (!inBounds(x, y)) return false;
+        if (!streaming()) return map[index(x, y)] != 'x';
+        int tile = chunks.peek(x, y);
+        return tile >= 0 && tile != 'x';
+    }
+
+    bool requestMove(int fromX, int fromY, int toX, int toY, bool isPlayer) {
+        PROFILE_SCOPE(PROF_REQUEST_MOVE);
+        if (!canMoveTo(toX, toY)) {
+            if (isPlayer) {
+                player->consumeOxygen(2);  // Consume oxygen even on failed move
+            }
+            return false;
+        }
+
+        if (isPlayer) {
+            // Check for enemy collision
+            int e = enemyIndex.first(toX, toY);
+            if (e != TileIndex::NONE) {
+                int i = 0;
+                int kind = enemies.locate(e, i);
+                player->takeDamage(enemies.batch(kind).damage[i]);
+                return false;  // Can't move into enemy
+            }
+            player->setPosition(toX, toY);
+            player->consumeOxygen(2);
+            if (streaming()) chunks.prefetch(toX, toY, 1);  // Page in what lies ahead
+            
+            // Illuminate current position
+            illuminated.set(toX, toY);
+            
+            // Check for collectibles
+            int c;
+            while ((c = collectibleIndex.first(toX, toY)) != TileIndex::NONE) {
+                Collectible& col = collectibles[c];
+                collectibleIndex.remove(c, toX, toY);
+                col.collected = true;
+                if (col.type == COIN) {
+                    score += 50;
+                } else if (col.type == BATTERY_PACK) {
+                    player->rechargeBattery(30);
+                    score += 20;
+                } else if (col.type == OXYGEN_TANK) {
+                    player->addOxygen(40);
+                    score += 20;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    void illuminateTile(int x, int y) {
+        PROFILE_SCOPE(PROF_ILLUMINATE);
+        if (inBounds(x, y)) {
+            if (player->useBattery()) {
+                illuminated.set(x, y);
+                
+                // Check if enemy is on this tile and activate/make visible
+                for (int e = enemyIndex.first(x, y); e != TileIndex::NONE; e = enemyIndex.nextOf(e)) {
+                    int i = 0;
+                    EnemyBatch& b = enemies.batch(enemies.locate(e, i));
+                    b.visible[i] = 1;
+                    b.active[i] = 1;
+                }
+            }
+        }
+    }
+
+    void updateEnemies() {
+        PROFILE_SCOPE(PROF_UPDATE_ENEMIES);
+        int px = player->getX();
+        int py = player->getY();
+        int damageTaken = 0;
+
+        for (int kind = 0; kind < ENEMY_KIND_COUNT; kind++) {
+            EnemyBatch& b = enemies.batch(kind);
+            int* xs = b.x.data();
+            int* ys = b.y.data();
+            unsigned char* active = b.active.data();
+            int n = b.size();
+            PROFILE_COUNT(PROF_ENEMIES_SCANNED, n);
+
+            // Visibility check - within sight range, in the diver's line of
+            // sight and illuminated. The range test is vectorised; only the
+            // few enemies near the diver need the field of view and light
+            nearby.resize(n);
+            int found = find_nearby(xs, ys, n, px, py, SIGHT_RANGE, nearby.data());
+            for (int j = 0; j < found; j++) {
+                int i = nearby[j];
+                if (canSee(xs[i], ys[i]) && illuminated.test(xs[i], ys[i])) {
+                    b.visible[i] = 1;
+                    active[i] = 1;
+                }
+            }
+
+            // Moving enemies step in two phases: every active one proposes a
+            // step against the positions at the start of the tick, in
+            // parallel for big batches, then the steps are applied in id
+            // order. Two enemies heading for the same tile: the lower id
+            // gets it and the other stays put.
+            if (kind == MOVING_ENEMY) {
+                targetX.resize(n);
+                targetY.resize(n);
+                wantsMove.resize(n);
+                tickKey = rng[RNG_AI].next();
+                // One BFS per diver move, and only while someone is chasing
+                if (!chase.isFor(px, py) && n > 0 && memchr(active, 1, n)) {
+                    chase.build(px, py, [this](int x, int y) { return canEnemyMoveTo(x, y); });
+                }
+                MoveProposals proposals(this);
+                int chunks = (n + ENEMY_CHUNK - 1) / ENEMY_CHUNK;
+                if (workers && n >= PARALLEL_ENEMY_MIN) {
+                    workers->run(&proposals, chunks);
+                } else {
+                    for (int c = 0; c < chunks; c++) proposals.run(c);
+                }
+                for (int i = 0; i < n; i++) {
+                    if (!wantsMove[i]) continue;
+                    if (claimedThisTick(targetX[i], targetY[i])) {
+                        wantsMove[i] = 0;
+                        continue;
+                    }
+                    enemyIndex.move(enemies.id(kind, i), xs[i], ys[i], targetX[i], targetY[i]);
+                    xs[i] = targetX[i];
+                    ys[i] = targetY[i];
+                }
+            }
+
+            // Check collision with player
+            damageTaken += collision_damage(xs, ys, b.damage.data(), n, px, py);
+        }
+        player->takeDamage(damageTaken);
+    }
+
+    void render(Screen& screen) const {
+        PROFILE_SCOPE(PROF_RENDER);
+        // Only the viewport around the player is drawn, so frame cost is
+        // bounded by the terminal rather than by the map size
+        int viewW = min(width, VIEW_WIDTH);
+        int viewH = min(height, VIEW_HEIGHT);
+        int left = max(0, min(player->getX() - viewW / 2, width - viewW));
+        int top = max(0, min(player->getY() - viewH / 2, height - viewH));
+        const FieldOfView& view = fov();
+
+        static const char* const footer[] = {
+            "",
+            "Controls:",
+            "WASD: Move | IJKL: Illuminate (I=up, J=left, K=down, L=right)",
+            "R: Restart | V: Save | T: Autopilot | P: Profile | Q: Quit",
+            "",
+            "Collect: * (Coins +50pts), B (Battery +30%), O (Oxygen +40%)"
+        };
+        const int footerLines = sizeof(footer) / sizeof(footer[0]);
+        static const char hudFormat[] = "Health: %d | Oxygen: %d | Battery: %d | Score: %d | Explored: %.1f%%";
+        char hud[128];
+        snprintf(hud, sizeof(hud), hudFormat, player->getHealth(), player->getOxygen(), player->getBattery(),
+                 score, 100.0 * illuminated.count() / ((double)width * height));
+        // The frame is as wide as the HUD can ever get, so a number gaining
+        // or losing a digit does not resize it and force a full redraw
+        char widest[128];
+        int hudCols = snprintf(widest, sizeof(widest), hudFormat, MAX_HEALTH, MAX_OXYGEN, MAX_BATTERY, INT_MAX, 100.0);
+        int cols = max(viewW, hudCols);
+        for (int i = 0; i < footerLines; i++) cols = max(cols, (int)strlen(footer[i]));
+
+        screen.begin(2 + viewH + footerLines, cols);
+        screen.text(0, 0, "=== HOLY DIVER - Exploration Mode ===");
+        screen.text(1, 0, hud);
+
+        long long drawn = 0;
+        for (int y = top; y < top + viewH; y++) {
+            int row = 2 + y - top;
+            // Dark tiles stay blank, so only lit runs are visited
+            for (int x = illuminated.nextLit(y, left, left + viewW); x < left + viewW;
+                 x = illuminated.nextLit(y, x, left + viewW)) {
+                int runEnd = illuminated.nextDark(y, x, left + viewW);
+                drawn += runEnd - x;
+                for (; x < runEnd; x++) {
+                    // Collectibles show above enemies, enemies above terrain
+                    char glyph;
+                    int c = collectibleIndex.first(x, y);
+                    if (c != TileIndex::NONE) {
+                        glyph = collectibles[c].type;
+                    } else {
+                        // Enemies only show where the diver can see them now;
+                        // the terrain stays as it was lit
+                        glyph = tileAt(x, y);
+                        if (view.visible(x, y) && enemyIndex.first(x, y) != TileIndex::NONE) {
+                            glyph = 'M';
+                        }
+                    }
+                    screen.put(row, x - left, glyph);
+                }
+            }
+        }
+        screen.put(2 + player->getY() - top, player->getX() - left, 'P');
+        PROFILE_COUNT(PROF_TILES_DRAWN, drawn);
+
+        for (int i = 0; i < footerLines; i++) {
+            screen.text(2 + viewH + i, 0, footer[i]);
+        }
+    }
+
+    // Wakes every enemy at once, as if each had been spotted (stress runs)
+    void alertEnemies() {
+        for (int k = 0; k < ENEMY_KIND_COUNT; k++) {
+            EnemyBatch& b = enemies.batch(k);
+            b.visible.assign(b.size(), 1);
+            b.active.assign(b.size(), 1);
+        }
+    }
+
+    Player* getPlayer() { return player; }
+    bool isGameOver() const { return player->isDead(); }
+    
+    // Identifies the level as it was loaded: the reset point, which holds
+    // the seeded random streams, and the terrain of a resident map
+    uint64_t levelHash() const {
+        uint64_t h = hash_bytes(pristine.data(), pristine.size(), 0);
+        if (!streaming()) h = hash_bytes(map.data(), map.size(), h);
+        return h;
+    }
+
+    // Back to the state right after loading, from memory: no file is read
+    // and a generated level comes back exactly as it was
+    void reset() {
+        string error;
+        restore(pristine.data(), pristine.size(), error);  // Captured by us, always valid
+    }
+    
+    int getScore() const { return score; }
+    int enemyCount(int kind) const { return enemies.batch(kind).size(); }
+    int collectibleCount() const { return collectibles.size(); }
+    int getWidth() const { return width; }
+    bool isStreaming() const { return streaming(); }
+    int residentChunks() const { return chunks.residentChunks(); }
+    long long chunkLoads() const { return chunks.chunkLoads(); }
+    int getHeight() const { return height; }
+};
+
+/****************************************************/
+// Terminal handling
+/****************************************************/
+static struct termios saved_term;
+static volatile sig_atomic_t terminal_resized = 0;
+
+void on_resize(int) {
+    terminal_resized = 1;
+}
+
+void setup_terminal() {
+    tcgetattr(STDIN_FILENO, &saved_term);
+    struct termios newt = saved_term;
+    newt.c_lflag &= ~(ICANON | ECHO);
+    newt.c_cc[VMIN] = 0;
+    newt.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+    signal(SIGWINCH, on_resize);
+}
+
+void restore_terminal() {
+    tcsetattr(STDIN_FILENO, TCSANOW, &saved_term);
+}
+
+/****************************************************/
+// Input queue
+/****************************************************/
+// Everything the terminal has buffered is taken with one read() and decoded
+// at once: arrow keys arrive as escape sequences and become w/a/s/d, other
+// sequences are skipped whole. Keys that are not player actions come back
+// as commands to handle right away; actions wait in a small ring that the
+// game drains one per player tick. A full ring drops its oldest action, so
+// a held or mashed key never replays for seconds after it is let go, and a
+// light key repeating the last queued one is dropped as redundant.
+class InputQueue {
+private:
+    char partial[8];   // Escape sequence cut off at the end of the last read
+    int partialLength;
+    char actions[ACTION_QUEUE_SIZE];
+    int head, count;
+
+    static bool isAction(char key) { return key != '\0' && strchr("wasdijkl", key); }
+
+    // Decodes one key starting at buf[i] and returns how many bytes it
+    // used, or 0 if the sequence is not complete yet. `key` is '\0' for
+    // sequences that mean nothing to the game.
+    static int decode(const char* buf, int n, int i, char& key) {
+        key = '\0';
+        if (buf[i] != '\033') {
+            key = tolower((unsigned char)buf[i]);
+            return 1;
+        }
+        if (i + 1 >= n) return 0;
+        if (buf[i + 1] != '[' && buf[i + 1] != 'O') return 1;  // Lone escape
+        int j = i + 2;
+        while (j < n && buf[j] >= 0x30 && buf[j] <= 0x3F) j++;  // Parameters
+        if (j >= n) return 0;
+        switch (buf[j]) {
+            case 'A': key = 'w'; break;
+            case 'B': key = 's'; break;
+            case 'C': key = 'd'; break;
+            case 'D': key = 'a'; break;
+        }
+        return j - i + 1;
+    }
+
+public:
+    InputQueue() : partialLength(0), head(0), count(0) {}
+
+    void clear() {
+        partialLength = 0;
+        head = count = 0;
+    }
+
+    void push(char action) {
+        if (count > 0 && strchr("ijkl", action) &&
+            actions[(head + count - 1) % ACTION_QUEUE_SIZE] == action) return;
+        if (count == ACTION_QUEUE_SIZE) {
+            head = (head + 1) % ACTION_QUEUE_SIZE;
+            count--;
+        }
+        actions[(head + count) % ACTION_QUEUE_SIZE] = action;
+        count++;
+    }
+
+    bool pop(char& action) {
+        if (count == 0) return false;
+        action = actions[head];
+        head = (head + 1) % ACTION_QUEUE_SIZE;
+        count--;
+        return true;
+    }
+
+    // Reads what is pending on fd, queues the actions and appends the
+    // other keys to `commands`. False once the input is closed.
+    bool drain(int fd, string& commands) {
+        char buf[sizeof(partial) + INPUT_READ_SIZE];
+        memcpy(buf, partial, partialLength);
+        ssize_t n = read(fd, buf + partialLength, INPUT_READ_SIZE);
+        if (n == 0) return false;
+        if (n < 0) return errno == EINTR || errno == EAGAIN;
+        int total = partialLength + n;
+        partialLength = 0;
+        for (int i = 0; i < total;) {
+            char key;
+            int used = decode(buf, total, i, key);
+            if (used == 0) {
+                // Keep the unfinished sequence for the next read, unless it
+                // is too long to be one we know
+                if (total - i <= (int)sizeof(partial)) {
+                    partialLength = total - i;
+                    memcpy(partial, buf + i, partialLength);
+                }
+                break;
+            }
+            i += used;
+            if (isAction(key)) {
+                push(key);
+            } else if (key != '\0') {
+                commands += key;
+            }
+        }
+        return true;
+    }
+
+    int size() const { return count; }
+};
+
+/****************************************************/
+// Tick timer
+/****************************************************/
+// Fixed-rate timer for the enemy tick. On Linux it is a timerfd that poll()
+// watches next to stdin; elsewhere poll() sleeps until the next deadline.
+class TickTimer {
+private:
+    int fd;
+    long long periodNs;
+    long long deadline;
+
+public:
+    explicit TickTimer(int periodMs) : fd(-1), periodNs(periodMs * 1000000LL) {
+        deadline = monotonic_ns() + periodNs;
+#ifdef __linux__
+        fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (fd >= 0) {
+            struct itimerspec spec;
+            spec.it_interval.tv_sec = periodMs / 1000;
+            spec.it_interval.tv_nsec = (periodMs % 1000) * 1000000L;
+            spec.it_value = spec.it_interval;
+            timerfd_settime(fd, 0, &spec, nullptr);
+        }
+#endif
+    }
+
+    ~TickTimer() {
+        if (fd >= 0) close(fd);
+    }
+
+    // Descriptor to poll for expirations, or -1 when pollTimeout() drives it
+    int getFd() const { return fd; }
+
+    // Milliseconds poll() may sleep before the next tick is due
+    int pollTimeout() const {
+        if (fd >= 0) return -1;
+        long long remaining = deadline - monotonic_ns();
+        if (remaining <= 0) return 0;
+        return (int)((remaining + 999999) / 1000000);
+    }
+
+    // Number of ticks that have elapsed since the last call
+    int expired() {
+        unsigned long long count = 0;
+        if (fd >= 0) {
+            if (read(fd, &count, sizeof(count)) != sizeof(count)) count = 0;
+        } else {
+            long long now = monotonic_ns();
+            if (now >= deadline) {
+                count = (now - deadline) / periodNs + 1;
+                deadline += count * periodNs;
+            }
+        }
+        return (int)min(count, (unsigned long long)MAX_CATCHUP_TICKS);
+    }
+};
+
+/****************************************************/
+// Player actions
+/****************************************************/
+// Applies a movement or light key for the player; returns false for keys
+// that are not player actions
+bool apply_action(World* world, char key) {
+    Player* p = world->getPlayer();
+    int px = p->getX();
+    int py = p->getY();
+    
+    switch(tolower((unsigned char)key)) {
+        case 'w': world->requestMove(px, py, px, py-1, true); break;
+        case 's': world->requestMove(px, py, px, py+1, true); break;
+        case 'a': world->requestMove(px, py, px-1, py, true); break;
+        case 'd': world->requestMove(px, py, px+1, py, true); break;
+        case 'i': world->illuminateTile(px, py-1); break;
+        case 'k': world->illuminateTile(px, py+1); break;
+        case 'j': world->illuminateTile(px-1, py); break;
+        case 'l': world->illuminateTile(px+1, py); break;
+        default: return false;
+    }
+    return true;
+}
+
+/****************************************************/
+// Autopilot
+/****************************************************/
+// Beam search over the local window. Every line is extended by each of the
+// eight actions and the PLAN_BEAM best of a depth go on to the next, at
+// most one per tile and set of collectibles taken, so the beam is not spent
+// on one swim in different orders. Lines killed by enemies are carried
+// along as they are; lines out of air stand still. The diver takes the
+// first action of the best line at the last depth and plans again on the
+// next tick.
+//
+// The goal is the nearest collectible left on the map, or the nearest
+// oxygen tank once air runs low. One the diver has not got nearer to in
+// PLAN_GOAL_PATIENCE decisions, say behind a wall the window cannot see
+// around, is passed over for the next; once every one has been passed
+// over, they all get another chance.
+class Autopilot {
+private:
+    struct Node {
+        PlanState state;
+        int value;
+        int first;  // Action the line started with
+    };
+    enum { SEEN_SLOTS = 1024 };  // Power of two above PLAN_BEAM * PLAN_ACTIONS
+
+    PlanWindow window;
+    vector<Node> beam, next;
+    vector<int> order;
+    vector<uint64_t> seen;
+    long long nodes;
+    int goal;                   // Collectible index, or -1
+    int goalBest;               // Fewest steps to it seen so far
+    int stalled;                // Decisions since goalBest went down
+    vector<uint8_t> skip;       // Goals passed over
+
+    static bool over(const PlanState& s) { return s.health <= 0 || s.oxygen <= 0; }
+
+    // Keeps the goal while it is there and getting nearer, else picks the
+    // next one and points the window at it
+    void aim(const World& world, const PlanState& root) {
+        int gx = 0, gy = 0;
+        char type = 0;
+        bool lowAir = root.oxygen < PLAN_LOW_OXYGEN;
+        bool keep = world.collectibleAt(goal, gx, gy, type) && (!lowAir || type == OXYGEN_TANK);
+        if (!keep || stalled >= PLAN_GOAL_PATIENCE) {
+            if (keep) {
+                if ((int)skip.size() <= goal) skip.resize(goal + 1, 0);
+                skip[goal] = 1;
+            }
+            goal = lowAir ? world.nearestCollectible(OXYGEN_TANK, skip) : -1;
+            if (goal < 0) goal = world.nearestCollectible(0, skip);
+            if (goal < 0 && !skip.empty()) {
+                skip.clear();
+                goal = world.nearestCollectible(0, skip);
+            }
+            goalBest = INT_MAX;
+            stalled = 0;
+            if (!world.collectibleAt(goal, gx, gy, type)) gx = -1;
+        }
+        window.aim(gx, gy);
+        int togo = window.toGoal[PlanWindow::cell(root.x, root.y)];
+        if (togo >= 0 && togo < goalBest) {
+            goalBest = togo;
+            stalled = 0;
+        } else {
+            stalled++;
+        }
+    }
+
+    // False when a line ending on the same tile with the same catch is
+    // already in the beam
+    bool firstVisit(const PlanState& s) {
+        uint64_t key = (s.taken * 0x9E3779B97F4A7C15ULL) ^ ((uint64_t)s.y << 8 | s.x) ^ (1ULL << 63);
+        for (size_t slot = (key ^ key >> 29) & (SEEN_SLOTS - 1);; slot = (slot + 1) & (SEEN_SLOTS - 1)) {
+            if (seen[slot] == key) return false;
+            if (seen[slot] == 0) {
+                seen[slot] = key;
+                return true;
+            }
+        }
+    }
+
+public:
+    Autopilot() : seen(SEEN_SLOTS), nodes(0), goal(-1), goalBest(INT_MAX), stalled(0) {
+        beam.reserve(PLAN_BEAM);
+        next.reserve(PLAN_BEAM * PLAN_ACTIONS);
+        order.reserve(PLAN_BEAM * PLAN_ACTIONS);
+    }
+
+    // The best action from `root`, one of PlanAction
+    int plan(const PlanState& root) {
+        Node start = { root, window.value(root), PLAN_UP };
+        beam.assign(1, start);
+        for (int depth = 0; depth < PLAN_DEPTH; depth++) {
+            next.clear();
+            for (size_t b = 0; b < beam.size(); b++) {
+                if (over(beam[b].state)) {
+                    Node child = beam[b];
+                    if (child.state.health > 0) {
+                        child.state.idle++;
+                        child.value = window.value(child.state);
+                    }
+                    next.push_back(child);
+                    continue;
+                }
+                for (int a = 0; a < PLAN_ACTIONS; a++) {
+                    Node child = beam[b];
+                    window.step(child.state, a);
+                    child.value = window.value(child.state);
+                    if (depth == 0) child.first = a;
+                    next.push_back(child);
+                }
+            }
+            nodes += next.size();
+
+            order.resize(next.size());
+            for (size_t i = 0; i < order.size(); i++) order[i] = i;
+            const vector<Node>& pool = next;
+            sort(order.begin(), order.end(), [&pool](int a, int b) {
+                return pool[a].value != pool[b].value ? pool[a].value > pool[b].value : a < b;
+            });
+            fill(seen.begin(), seen.end(), 0);
+            beam.clear();
+            for (size_t i = 0; i < order.size() && (int)beam.size() < PLAN_BEAM; i++) {
+                if (firstVisit(next[order[i]].state)) beam.push_back(next[order[i]]);
+            }
+        }
+        return beam[0].first;
+    }
+
+    char choose(const World& world) {
+        PlanState root;
+        world.takeWindow(window, root);
+        aim(world, root);
+        return PLAN_KEYS[plan(root)];
+    }
+
+    long long nodeCount() const { return nodes; }
+};
+
+/****************************************************/
+// Session Log
+/****************************************************/
+// Every action a session applied, keyed by how many enemy ticks had run
+// before it, plus what it takes to start the same session again: seed,
+// map and a hash of the level as loaded. Playing the actions back with
+// the enemy ticks between them repeats the session exactly, so the final
+// score doubles as a check. Layout, little-endian:
+//   SessionLogHeader
+//   map path      mapLength bytes, as given to --map
+//   resume path   resumeLength bytes, as given to --resume
+//   events        per action: LEB128 enemy ticks since the previous
+//                 action, then the key byte
+const char SESSION_LOG_MAGIC[8] = { 'H', 'D', 'I', 'V', 'R', 'E', 'P', 'L' };
+const uint32_t SESSION_LOG_VERSION = 1;
+
+struct SessionLogHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t seed;
+    uint64_t levelHash;
+    uint64_t ticks;          // Enemy ticks the session ran
+    uint32_t eventCount;
+    int32_t score;           // Final score
+    int32_t chunkBudget;     // 0 unless the map was streamed
+    uint32_t mapLength, resumeLength;
+    uint32_t padding;
+};
+
+class SessionLog {
+private:
+    SessionLogHeader header;
+    string mapPath, resumePath;
+    vector<uint8_t> events;
+    uint64_t lastTick;
+
+    static bool readVarint(const vector<uint8_t>& in, size_t& offset, uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64 && offset < in.size(); shift += 7) {
+            uint8_t byte = in[offset++];
+            value |= (uint64_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    }
+
+public:
+    SessionLog() { begin("", "", 0, 0, 0); }
+
+    // Starts an empty log for a session on a freshly loaded or reset world
+    void begin(const string& map, const string& resume, int chunkBudget, uint32_t seed, uint64_t levelHash) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, SESSION_LOG_MAGIC, sizeof(header.magic));
+        header.version = SESSION_LOG_VERSION;
+        header.seed = seed;
+        header.levelHash = levelHash;
+        header.chunkBudget = chunkBudget;
+        mapPath = map;
+        resumePath = resume;
+        events.clear();
+        lastTick = 0;
+    }
+
+    void record(uint64_t tick, char key) {
+        uint64_t delta = tick - lastTick;
+        lastTick = tick;
+        for (; delta >= 0x80; delta >>= 7) events.push_back((uint8_t)(delta | 0x80));
+        events.push_back((uint8_t)delta);
+        events.push_back((uint8_t)key);
+        header.eventCount++;
+    }
+
+    void finish(uint64_t ticks, int score) {
+        header.ticks = ticks;
+        header.score = score;
+    }
+
+    bool save(const string& filepath, string& error) const {
+        SessionLogHeader out = header;
+        out.mapLength = mapPath.size();
+        out.resumeLength = resumePath.size();
+        FILE* file = fopen(filepath.c_str(), "wb");
+        if (!file) {
+            error = filepath + ": " + strerror(errno);
+            return false;
+        }
+        fwrite(&out, sizeof(out), 1, file);
+        fwrite(mapPath.data(), 1, mapPath.size(), file);
+        fwrite(resumePath.data(), 1, resumePath.size(), file);
+        fwrite(events.data(), 1, events.size(), file);
+        if (ferror(file) | fclose(file)) {
+            error = filepath + ": write failed";
+            return false;
+        }
+        return true;
+    }
+
+    // Checks the whole log, every event included, before taking it
+    bool load(const string& filepath, string& error) {
+        MappedFile file;
+        if (!file.open(filepath, error)) return false;
+        SessionLogHeader in;
+        if (file.size() < sizeof(in)) {
+            error = filepath + ": truncated session log";
+            return false;
+        }
+        memcpy(&in, file.data(), sizeof(in));
+        if (memcmp(in.magic, SESSION_LOG_MAGIC, sizeof(in.magic)) != 0 || in.version != SESSION_LOG_VERSION) {
+            error = filepath + ": not a session log, or an unsupported version";
+            return false;
+        }
+        uint64_t paths = (uint64_t)in.mapLength + in.resumeLength;
+        if (paths > file.size() - sizeof(in)) {
+            error = filepath + ": truncated session log";
+            return false;
+        }
+        const char* p = file.data() + sizeof(in);
+        vector<uint8_t> body(p + paths, file.data() + file.size());
+        size_t offset = 0;
+        uint64_t tick = 0;
+        for (uint32_t i = 0; i < in.eventCount; i++) {
+            uint64_t delta;
+            if (!readVarint(body, offset, delta) || offset >= body.size() || delta > in.ticks - tick) {
+                error = filepath + ": bad event";
+                return false;
+            }
+            tick += delta;
+            offset++;
+        }
+        if (offset != body.size()) {
+            error = filepath + ": bad event";
+            return false;
+        }
+        header = in;
+        mapPath.assign(p, in.mapLength);
+        resumePath.assign(p + in.mapLength, in.resumeLength);
+        events.swap(body);
+        lastTick = tick;
+        return true;
+    }
+
+    // Walks the events in order; false past the last one
+    struct Cursor {
+        size_t offset;
+        uint64_t tick;
+    };
+    Cursor start() const { Cursor c = { 0, 0 }; return c; }
+
+    bool next(Cursor& cursor, uint64_t& tick, char& key) const {
+        uint64_t delta;
+        if (cursor.offset >= events.size() || !readVarint(events, cursor.offset, delta)) return false;
+        cursor.tick += delta;
+        tick = cursor.tick;
+        key = (char)events[cursor.offset++];
+        return true;
+    }
+
+    uint32_t seed() const { return header.seed; }
+    uint64_t levelHash() const { return header.levelHash; }
+    uint64_t ticks() const { return header.ticks; }
+    int score() const { return header.score; }
+    int chunkBudget() const { return header.chunkBudget; }
+    uint32_t eventCount() const { return header.eventCount; }
+    size_t eventBytes() const { return events.size(); }
+    const string& map() const { return mapPath; }
+    const string& resume() const { return resumePath; }
+};
+
+/****************************************************/
+// Headless simulation
+/****************************************************/
+// Runs the game without rendering or sleeping: each tick applies one key
+// from the script (or the policy) and then advances the enemies once.
+enum Policy { POLICY_SCRIPT, POLICY_IDLE, POLICY_RANDOM, POLICY_EXPLORE, POLICY_AUTOPILOT };
+
+enum Outcome { OUTCOME_SURVIVED, OUTCOME_HEALTH, OUTCOME_OXYGEN, OUTCOME_COUNT };
+const char* const OUTCOME_NAMES[OUTCOME_COUNT] = { "survived", "died (health)", "died (oxygen)" };
+
+struct SimResult {
+    long long ticks;
+    int score;
+    Outcome outcome;
+    double seconds;
+};
+
+// Policies draw from their own random state so sessions can run side by side
+char policy_key(Policy policy, World* world, long long tick, int& heading, Rng& rng, Autopilot& pilot) {
+    static const char moves[] = { 'w', 'd', 's', 'a' };
+    static const char lights[] = { 'i', 'l', 'k', 'j' };
+    static const int dx[] = { 0, 1, 0, -1 };
+    static const int dy[] = { -1, 0, 1, 0 };
+    
+    if (policy == POLICY_RANDOM) {
+        static const char keys[] = "wasdijkl";
+        return keys[rng.below(8)];
+    }
+    if (policy == POLICY_EXPLORE) {
+        // Swim straight, light the tile ahead every few strokes, and turn
+        // clockwise when blocked
+        Player* p = world->getPlayer();
+        if (!world->canMoveTo(p->getX() + dx[heading], p->getY() + dy[heading])) {
+            heading = (heading + 1 + rng.below(2) * 2) % 4;
+            return lights[heading];
+        }
+        return tick % 4 == 0 ? lights[heading] : moves[heading];
+    }
+    if (policy == POLICY_AUTOPILOT) return pilot.choose(*world);
+    return '.';
+}
+
+// `seed` picks the policy's random stream; `log`, when given, records
+// every action applied
+SimResult run_headless(World* world, Policy policy, const string& script, long long maxTicks, uint64_t seed,
+                       SessionLog* log = nullptr) {
+    SimResult result = { 0, 0, OUTCOME_SURVIVED, 0.0 };
+    int heading = 0;
+    Rng rng;
+    Autopilot pilot;
+    rng.seed(seed, RNG_POLICY);
+    long long start = monotonic_ns();
+    
+    while (result.ticks < maxTicks) {
+        char key;
+        if (policy == POLICY_SCRIPT) {
+            if (result.ticks >= (long long)script.size()) break;
+            key = script[result.ticks];
+        } else {
+            key = policy_key(policy, world, result.ticks, heading, rng, pilot);
+        }
+        if (apply_action(world, key) && log) log->record(result.ticks, key);
+        world->updateEnemies();
+        result.ticks++;
+        if (world->isGameOver()) {
+            result.outcome = world->getPlayer()->getHealth() <= 0 ? OUTCOME_HEALTH : OUTCOME_OXYGEN;
+            break;
+        }
+    }
+    
+    result.seconds = (monotonic_ns() - start) / 1e9;
+    result.score = world->getScore();
+    if (log) log->finish(result.ticks, result.score);
+    return result;
+}
+
+// Plays a session log back on a world opened the way the session was:
+// the actions logged for each tick, then the enemy tick, until the logged
+// tick count or the end of the game. `onTick` sees the world after every
+// enemy tick, for rendered playback.
+template <class OnTick>
+SimResult run_replay(World* world, const SessionLog& log, OnTick onTick) {
+    SimResult result = { 0, 0, OUTCOME_SURVIVED, 0.0 };
+    long long start = monotonic_ns();
+    SessionLog::Cursor cursor = log.start();
+    uint64_t eventTick = 0;
+    char key = '\0';
+    bool more = log.next(cursor, eventTick, key);
+    for (uint64_t tick = 0;; tick++) {
+        for (; more && eventTick == tick; more = log.next(cursor, eventTick, key)) apply_action(world, key);
+        if (tick == log.ticks()) break;
+        world->updateEnemies();
+        result.ticks++;
+        onTick(*world);
+        if (world->isGameOver()) break;
+    }
+    if (world->isGameOver()) {
+        result.outcome = world->getPlayer()->getHealth() <= 0 ? OUTCOME_HEALTH : OUTCOME_OXYGEN;
+    }
+    result.seconds = (monotonic_ns() - start) / 1e9;
+    result.score = world->getScore();
+    return result;
+}
+
+/****************************************************/
+// Batch simulation
+/****************************************************/
+// Runs many independent headless sessions on a pool of threads. The map is
+// loaded once; each worker owns a World that restores the loaded snapshot
+// before every session and reseeds it with the session's own seed, so a
+// session's result does not depend on which thread ran it or when.
+struct BatchConfig {
+    string mapPath;
+    int chunkBudget;
+    Policy policy;
+    string script;
+    long long maxTicks;
+    unsigned seed;      // Session i uses seed + i
+    int sessions;
+    int threads;
+};
+
+struct BatchResult {
+    vector<SimResult> sessions;  // In session order
+    double seconds;
+};
+
+bool run_batch(const World& loaded, const BatchConfig& config, BatchResult& result, string& error) {
+    // Workers take the terrain once, then restart from the lighter snapshot
+    vector<char> terrain, start;
+    if (!loaded.isStreaming()) loaded.capture(terrain, true);
+    loaded.capture(start, false);
+
+    int threads = max(1, min(config.threads, config.sessions));
+    result.sessions.assign(config.sessions, SimResult());
+    vector<string> errors(threads);
+    atomic<int> next(0);
+    long long begin = monotonic_ns();
+
+    vector<thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.push_back(thread([&, t]() {
+            World world;
+            bool ready = config.chunkBudget > 0
+                ? world.streamMap(config.mapPath, config.chunkBudget, errors[t])
+                : world.restore(terrain.data(), terrain.size(), errors[t]);
+            if (!ready) return;
+            for (int i = next++; i < config.sessions; i = next++) {
+                world.restore(start.data(), start.size(), errors[t]);
+                world.seed(config.seed + i);
+                result.sessions[i] = run_headless(&world, config.policy, config.script, config.maxTicks,
+                                                  config.seed + i);
+            }
+        }));
+    }
+    for (int t = 0; t < threads; t++) pool[t].join();
+    result.seconds = (monotonic_ns() - begin) / 1e9;
+
+    for (int t = 0; t < threads; t++) {
+        if (!errors[t].empty()) {
+            error = errors[t];
+            return false;
+        }
+    }
+    return true;
+}
+
+// Script files hold one key per tick; whitespace is ignored and '.' idles
+bool read_script(const string& path, string& script) {
+    ifstream file(path);
+    if (!file.is_open()) return false;
+    char c;
+    while (file.get(c)) {
+        if (!isspace((unsigned char)c)) script += c;
+    }
+    return true;
+}
+
+void print_usage(const char* argv0) {
+    cerr << "Usage: " << argv0 << " [--map PATH|level:NAME] [--seed N] [--stream [--chunk-budget N]]" << endl;
+    cerr << "           [--resume SAVE] [--save SAVE] [--threads N] [--profile FILE] [--record LOG]" << endl;
+    cerr << "       " << argv0 << " --headless [--map PATH] [--seed N] [--ticks N]" << endl;
+    cerr << "           [--script FILE | --policy idle|random|explore|autopilot] [--stream [--chunk-budget N]]" << endl;
+    cerr << "           [--resume SAVE] [--save SAVE] [--threads N] [--profile FILE] [--record LOG]" << endl;
+    cerr << "       " << argv0 << " --batch SESSIONS [--threads N] [headless options but --save, --profile, --record]" << endl;
+    cerr << "       " << argv0 << " --replay LOG [--headless | --speed X] [--threads N]" << endl;
+    cerr << "       " << argv0 << " --convert TEXT_MAP BINARY_MAP [--seed N]" << endl;
+}
+
+// Loads or streams the map, then resumes a save game on top of it. A save
+// carries its own tiles unless it was made on a streamed map, so it needs no
+// --map otherwise.
+bool open_world(World& world, const string& filepath, int chunkBudget, const string& resumePath, string& error) {
+    if (!resumePath.empty() && filepath.empty()) return world.loadGame(resumePath, error);
+    string path = filepath.empty() ? "default" : filepath;
+    if (!(chunkBudget > 0 ? world.streamMap(path, chunkBudget, error) : world.loadMap(path, error))) return false;
+    return resumePath.empty() || world.loadGame(resumePath, error);
+}
+
+// Plays a session log back, headless at full speed or rendered at `speed`
+// times the game's pace (0 draws every tick without waiting), then checks
+// the final score against the log's. Returns the exit status.
+int replay_session(const string& logPath, bool headless, double speed, int threads) {
+    SessionLog log;
+    string error;
+    if (!log.load(logPath, error)) {
+        cerr << "Cannot read session log: " << error << endl;
+        return 1;
+    }
+    World world;
+    world.seed(log.seed());
+    if (!open_world(world, log.map(), log.chunkBudget(), log.resume(), error)) {
+        cerr << "Cannot load map: " << error << endl;
+        return 1;
+    }
+    if (world.levelHash() != log.levelHash()) {
+        cerr << "Cannot replay: the level differs from the one the session was recorded on" << endl;
+        return 1;
+    }
+    WorkerPool pool(threads - 1);
+    world.setWorkers(&pool);
+
+    SimResult result;
+    if (headless) {
+        result = run_replay(&world, log, [](const World&) {});
+    } else {
+        Screen screen;
+        long long periodNs = speed > 0 ? (long long)(ENEMY_TICK_MS * 1e6 / speed) : 0;
+        world.render(screen);
+        screen.present(STDOUT_FILENO);
+        result = run_replay(&world, log, [&screen, periodNs](const World& w) {
+            if (periodNs > 0) {
+                struct timespec pause = { (time_t)(periodNs / 1000000000LL), (long)(periodNs % 1000000000LL) };
+                nanosleep(&pause, nullptr);
+            }
+            w.render(screen);
+            screen.present(STDOUT_FILENO);
+        });
+        cout << endl;
+    }
+    bool verified = result.score == log.score() && (uint64_t)result.ticks == log.ticks();
+    printf("seed: %u\n", log.seed());
+    printf("ticks: %lld of %llu\n", result.ticks, (unsigned long long)log.ticks());
+    printf("actions: %u in %zu bytes\n", log.eventCount(), log.eventBytes());
+    printf("ticks/sec: %.0f\n", result.seconds > 0 ? result.ticks / result.seconds : 0.0);
+    printf("score: %d (recorded %d)\n", result.score, log.score());
+    printf("outcome: %s\n", OUTCOME_NAMES[result.outcome]);
+    printf("verified: %s\n", verified ? "yes" : "NO");
+    return verified ? 0 : 1;
+}
+
+#ifndef HOLY_DIVER_NO_MAIN
+/****************************************************/
+// Main game loop
+/****************************************************/
+int main(int argc, char** argv) {
+    string filepath;
+    unsigned seed = 0;
+    bool seedGiven = false;
+    bool headless = false;
+    Policy policy = POLICY_EXPLORE;
+    string scriptPath;
+    long long maxTicks = 100000;
+    string convertTo;
+    int chunkBudget = 0;  // Streams the map when set
+    string resumePath;
+    string savePath;
+    string profilePath;
+    string recordPath;
+    string replayPath;
+    double speed = 1.0;  // Rendered replay pace
+    int sessions = 0;  // Batch mode when set
+    int threads = max(1u, thread::hardware_concurrency());  // Sessions or enemy updates
+    
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--headless") {
+            headless = true;
+        } else if (arg == "--map" && hasValue) {
+            filepath = argv[++i];
+        } else if (arg == "--seed" && hasValue) {
+            seed = strtoul(argv[++i], nullptr, 10);
+            seedGiven = true;
+        } else if (arg == "--ticks" && hasValue) {
+            maxTicks = strtoll(argv[++i], nullptr, 10);
+        } else if (arg == "--script" && hasValue) {
+            scriptPath = argv[++i];
+            policy = POLICY_SCRIPT;
+        } else if (arg == "--stream") {
+            if (chunkBudget == 0) chunkBudget = DEFAULT_CHUNK_BUDGET;
+        } else if (arg == "--chunk-budget" && hasValue) {
+            chunkBudget = max(atoi(argv[++i]), MIN_CHUNK_BUDGET);
+        } else if (arg == "--batch" && hasValue) {
+            sessions = max(1, atoi(argv[++i]));
+            headless = true;
+        } else if (arg == "--threads" && hasValue) {
+            threads = max(1, atoi(argv[++i]));
+        } else if (arg == "--resume" && hasValue) {
+            resumePath = argv[++i];
+        } else if (arg == "--save" && hasValue) {
+            savePath = argv[++i];
+        } else if (arg == "--profile" && hasValue) {
+            profilePath = argv[++i];
+        } else if (arg == "--record" && hasValue) {
+            recordPath = argv[++i];
+        } else if (arg == "--replay" && hasValue) {
+            replayPath = argv[++i];
+        } else if (arg == "--speed" && hasValue) {
+            speed = max(0.0, atof(argv[++i]));
+        } else if (arg == "--convert" && i + 2 < argc) {
+            filepath = argv[++i];
+            convertTo = argv[++i];
+        } else if (arg == "--policy" && hasValue) {
+            string name = argv[++i];
+            if (name == "idle") policy = POLICY_IDLE;
+            else if (name == "random") policy = POLICY_RANDOM;
+            else if (name == "explore") policy = POLICY_EXPLORE;
+            else if (name == "autopilot") policy = POLICY_AUTOPILOT;
+            else { print_usage(argv[0]); return 1; }
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    // One file cannot hold a batch's sessions, and the profiler's probes
+    // are for one thread
+    if (sessions > 0 && !(savePath.empty() && profilePath.empty() && recordPath.empty())) {
+        cerr << "--batch cannot be combined with --save, --profile or --record" << endl;
+        print_usage(argv[0]);
+        return 1;
+    }
+    // Headless runs are reproducible by default; interactive games are not
+    if (!seedGiven) seed = headless ? 1 : time(NULL);
+    
+    // Enemy kinds are rolled here with the seed and stored in the binary map
+    if (!convertTo.empty()) {
+        World world;
+        world.seed(seed);
+        string error;
+        if (!world.loadMap(filepath, error) || !world.saveBinaryMap(convertTo, error)) {
+            cerr << "Cannot convert map: " << error << endl;
+            return 1;
+        }
+        printf("wrote %s (%dx%d)\n", convertTo.c_str(), world.getWidth(), world.getHeight());
+        return 0;
+    }
+    
+    // The log names its own map and seed
+    if (!replayPath.empty()) return replay_session(replayPath, headless, speed, threads);
+    
+    if (headless) {
+        string script;
+        if (policy == POLICY_SCRIPT && !read_script(scriptPath, script)) {
+            cerr << "Cannot read script: " << scriptPath << endl;
+            return 1;
+        }
+        World world;
+        world.seed(seed);
+        string error;
+        if (!open_world(world, filepath, chunkBudget, resumePath, error)) {
+            cerr << "Cannot load map: " << error << endl;
+            return 1;
+        }
+        
+        if (sessions > 0) {
+            BatchConfig config = { filepath, chunkBudget, policy, script, maxTicks, seed, sessions, threads };
+            BatchResult batch;
+            if (!run_batch(world, config, batch, error)) {
+                cerr << "Batch failed: " << error << endl;
+                return 1;
+            }
+            long long ticks = 0, minTicks = LLONG_MAX, maxSurvived = 0;
+            long long scoreSum = 0;
+            int minScore = INT_MAX, maxScore = INT_MIN;
+            int outcomes[OUTCOME_COUNT] = { 0 };
+            for (int i = 0; i < sessions; i++) {
+                const SimResult& r = batch.sessions[i];
+                ticks += r.ticks;
+                minTicks = min(minTicks, r.ticks);
+                maxSurvived = max(maxSurvived, r.ticks);
+                scoreSum += r.score;
+                minScore = min(minScore, r.score);
+                maxScore = max(maxScore, r.score);
+                outcomes[r.outcome]++;
+            }
+            printf("sessions: %d on %d threads, seeds %u..%u\n", sessions, min(threads, sessions), seed,
+                   seed + sessions - 1);
+            printf("sessions/sec: %.0f\n", batch.seconds > 0 ? sessions / batch.seconds : 0.0);
+            printf("ticks/sec: %.0f\n", batch.seconds > 0 ? ticks / batch.seconds : 0.0);
+            printf("score: mean %.2f, min %d, max %d\n", (double)scoreSum / sessions, minScore, maxScore);
+            printf("survival ticks: mean %.2f, min %lld, max %lld\n", (double)ticks / sessions, minTicks,
+                   maxSurvived);
+            for (int o = 0; o < OUTCOME_COUNT; o++) printf("%s: %d\n", OUTCOME_NAMES[o], outcomes[o]);
+            return 0;
+        }
+        
+        // Batches leave the profiler off: its probes are for one thread
+        WorkerPool pool(threads - 1);
+        world.setWorkers(&pool);
+        profiler.enable(!profilePath.empty());
+        SessionLog log;
+        log.begin(filepath, resumePath, chunkBudget, seed, world.levelHash());
+        SimResult result = run_headless(&world, policy, script, maxTicks, seed, recordPath.empty() ? nullptr : &log);
+        if (!recordPath.empty() && !log.save(recordPath, error)) {
+            cerr << "Cannot write session log: " << error << endl;
+            return 1;
+        }
+        if (!savePath.empty() && !world.saveGame(savePath, error)) {
+            cerr << "Cannot save game: " << error << endl;
+            return 1;
+        }
+        if (!profilePath.empty() && !profiler.dump(profilePath, error)) {
+            cerr << "Cannot write profile: " << error << endl;
+            return 1;
+        }
+        printf("seed: %u\n", seed);
+        printf("ticks: %lld\n", result.ticks);
+        printf("ticks/sec: %.0f\n", result.seconds > 0 ? result.ticks / result.seconds : 0.0);
+        printf("score: %d\n", result.score);
+        printf("outcome: %s\n", OUTCOME_NAMES[result.outcome]);
+        if (chunkBudget > 0) {
+            printf("chunks: %d resident, %lld loaded\n", world.residentChunks(), world.chunkLoads());
+        }
+        return 0;
+    }
+    
+    cout << "=== HOLY DIVER ===" << endl;
+    if (filepath.empty() && resumePath.empty()) {
+        cout << "Enter map filepath (or press Enter for default): ";
+        getline(cin, filepath);
+    }
+    if (savePath.empty()) savePath = "holy_diver.sav";
+    profiler.enable(true);  // Cheap enough to leave on for 'p'; dumped on exit with --profile
+
+    // One world serves the whole session; every new game is a reset
+    WorkerPool pool(threads - 1);
+    World world;
+    world.setWorkers(&pool);
+    world.seed(seed);
+    string error;
+    if (!open_world(world, filepath, chunkBudget, resumePath, error)) {
+        cerr << "Cannot load map: " << error << endl;
+        return 1;
+    }
+
+    bool playAgain = true;
+    Screen screen;
+    Autopilot pilot;
+    bool autopilot = false;  // 't' hands the diver to the autopilot and back
+    bool showProfile = false;  // 'p' shows the profiler over the map
+    InputQueue input;
+    // Each game is recorded from its start and, with --record, the log
+    // written when it ends, so the last game can be replayed with --replay
+    SessionLog log;
+    uint64_t enemyTicks = 0;
+    
+    while (playAgain) {
+        setup_terminal();
+        screen.invalidate();
+        input.clear();
+        log.begin(filepath, resumePath, chunkBudget, seed, world.levelHash());
+        enemyTicks = 0;
+        TickTimer enemyTimer(ENEMY_TICK_MS);
+        TickTimer playerTimer(PLAYER_TICK_MS);
+        TickTimer* timers[] = { &enemyTimer, &playerTimer };
+        
+        // Sleep in poll() until a key arrives or a tick fires, and only
+        // redraw when one of them changed something
+        bool running = true;
+        bool dirty = true;
+        while (running) {
+            if (terminal_resized) {
+                terminal_resized = 0;
+                screen.invalidate();
+                dirty = true;
+            }
+            if (dirty) {
+                world.render(screen);
+                if (showProfile) profiler.draw(screen, 2);
+                screen.present(STDOUT_FILENO);
+                dirty = false;
+            }
+            
+            struct pollfd fds[3];
+            fds[0].fd = STDIN_FILENO;
+            fds[0].events = POLLIN;
+            int nfds = 1;
+            int timeout = -1;
+            for (int t = 0; t < 2; t++) {
+                if (timers[t]->getFd() >= 0) {
+                    fds[nfds].fd = timers[t]->getFd();
+                    fds[nfds++].events = POLLIN;
+                } else {
+                    int ms = timers[t]->pollTimeout();
+                    timeout = timeout < 0 ? ms : min(timeout, ms);
+                }
+            }
+            if (poll(fds, nfds, timeout) < 0) {
+                if (errno == EINTR) continue;  // SIGWINCH
+                break;
+            }
+            
+            // Commands act as soon as poll() reports them; moves and
+            // lights are queued for the player tick
+            if (fds[0].revents & (POLLIN | POLLHUP)) {
+                PROFILE_SCOPE(PROF_INPUT);
+                string commands;
+                if (!input.drain(STDIN_FILENO, commands)) {
+                    running = false;  // stdin closed
+                    playAgain = false;
+                }
+                for (size_t i = 0; i < commands.size() && running; i++) {
+                    char key = commands[i];
+                    if (key == 'r') {
+                        world.reset();
+                        input.clear();
+                        log.begin(filepath, resumePath, chunkBudget, seed, world.levelHash());
+                        enemyTicks = 0;
+                        screen.invalidate();
+                    } else if (key == 'v') {
+                        if (!world.saveGame(savePath, error)) {
+                            restore_terminal();
+                            cerr << "\nCannot save game: " << error << endl;
+                            return 1;
+                        }
+                    } else if (key == 'q') {
+                        running = false;
+                        playAgain = false;
+                    } else if (key == 't') {
+                        autopilot = !autopilot;
+                    } else if (key == 'p') {
+                        showProfile = !showProfile;
+                    }
+                }
+                dirty = true;
+            }
+            
+            // One queued action per player tick, so a tap shows within a tick
+            char action;
+            for (int ticks = playerTimer.expired(); ticks > 0 && !world.isGameOver() && input.pop(action);
+                 ticks--) {
+                if (apply_action(&world, action)) log.record(enemyTicks, action);
+                dirty = true;
+            }
+            
+            // The autopilot takes one action per enemy tick, like a headless run
+            for (int ticks = enemyTimer.expired(); ticks > 0 && !world.isGameOver(); ticks--) {
+                if (autopilot) {
+                    char key = pilot.choose(world);
+                    if (apply_action(&world, key)) log.record(enemyTicks, key);
+                }
+                world.updateEnemies();
+                enemyTicks++;
+                dirty = true;
+            }
+            
+            if (running && world.isGameOver()) {
+                world.render(screen);
+                if (showProfile) profiler.draw(screen, 2);
+                screen.present(STDOUT_FILENO);
+                restore_terminal();
+                cout << "\n=== GAME OVER ===" << endl;
+                cout << "Final Score: " << world.getScore() << endl;
+                cout << "\nPress Enter to play again, or Q then Enter to quit: ";
+                
+                string response;
+                getline(cin, response);
+                
+                if (!response.empty() && (response[0] == 'q' || response[0] == 'Q')) {
+                    playAgain = false;
+                }
+                running = false;
+            }
+        }
+        
+        restore_terminal();
+        log.finish(enemyTicks, world.getScore());
+        if (!recordPath.empty() && !log.save(recordPath, error)) cerr << "Cannot write session log: " << error << endl;
+        if (playAgain) world.reset();
+    }
+    
+    cout << "\nThanks for playing!" << endl;
+    if (!profilePath.empty() && !profiler.dump(profilePath, error)) cerr << "Cannot write profile: " << error << endl;
+    return 0;
+}
+#endif  // HOLY_DIVER_NO_MAIN
\ No newline at end of file
@@ -0,0 +1,425 @@
+// Microbenchmarks for the World hot paths.
+// Build: g++ -std=c++11 -O2 -pthread holy_diver_bench.cpp -o holy_diver_bench
+// Run:   ./holy_diver_bench [name-filter]
+#define HOLY_DIVER_NO_MAIN
+#include "holy_diver.cpp"
+
+#include <new>
+
+/****************************************************/
+// Allocation counting
+/****************************************************/
+static unsigned long long allocation_count = 0;
+
+void* operator new(size_t size) {
+    allocation_count++;
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+// Kept out of line: GCC otherwise inlines the free() into callers whose
+// pointer came from a new expression and warns -Wmismatched-new-delete
+__attribute__((noinline)) static void release(void* p) {
+    free(p);
+}
+
+void operator delete(void* p) noexcept {
+    release(p);
+}
+
+/****************************************************/
+// Timing harness
+/****************************************************/
+// Each case runs in batches that grow until one batch takes BATCH_NS; the
+// reported figure is the median of SAMPLES batches, which keeps the numbers
+// stable from run to run.
+const long long BATCH_NS = 50000000;
+const int SAMPLES = 5;
+
+static string name_filter;
+static volatile unsigned long long sink;  // Keeps results observable
+
+struct Case {
+    virtual ~Case() {}
+    virtual void setUp() {}
+    virtual void run() = 0;  // One operation
+};
+
+void report(const string& name, Case& c) {
+    if (!name_filter.empty() && name.find(name_filter) == string::npos) return;
+
+    c.setUp();
+    long long iterations = 1;
+    for (;;) {
+        long long start = monotonic_ns();
+        for (long long i = 0; i < iterations; i++) c.run();
+        if (monotonic_ns() - start >= BATCH_NS / 10 || iterations >= (1LL << 30)) break;
+        iterations *= 2;
+    }
+    iterations *= 10;  // Calibrated to roughly BATCH_NS per sample
+
+    vector<double> nsPerOp;
+    unsigned long long allocs = 0;
+    for (int s = 0; s < SAMPLES; s++) {
+        unsigned long long allocsBefore = allocation_count;
+        long long start = monotonic_ns();
+        for (long long i = 0; i < iterations; i++) c.run();
+        nsPerOp.push_back((double)(monotonic_ns() - start) / iterations);
+        allocs += allocation_count - allocsBefore;
+    }
+    sort(nsPerOp.begin(), nsPerOp.end());
+    printf("%-44s %14.1f ns/op %12.2f allocs/op\n", name.c_str(), nsPerOp[SAMPLES / 2],
+           (double)allocs / (SAMPLES * iterations));
+    fflush(stdout);
+}
+
+/****************************************************/
+// Fixtures
+/****************************************************/
+struct MapSpec {
+    int width, height;
+    int enemies, collectibles;
+};
+
+string spec_name(const char* op, const MapSpec& spec) {
+    char buf[96];
+    snprintf(buf, sizeof(buf), "%s/%dx%d/e%d/c%d", op, spec.width, spec.height,
+             spec.enemies, spec.collectibles);
+    return buf;
+}
+
+// Fresh world built from a fixed seed so every run measures the same layout
+World* make_world(const MapSpec& spec, bool alerted) {
+    World* world = new World();
+    world->seed(12345);
+    world->createRandomMap(spec.width, spec.height, spec.enemies, spec.collectibles);
+    if (alerted) world->alertEnemies();
+    return world;
+}
+
+// Writes a text map with the spec's size, enemy and collectible counts.
+// Rock goes down first, then enemies and items on open water, the way
+// createRandomMap lays out a level
+string write_map_file(const MapSpec& spec) {
+    srand(12345);
+    string path = "/tmp/holy_diver_bench_map.txt";
+    int w = spec.width, h = spec.height;
+    string grid((size_t)w * h, 'o');
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            if (x == 0 || y == 0 || x == w - 1 || y == h - 1 || rand() % 16 == 0) grid[(size_t)y * w + x] = 'x';
+        }
+    }
+    grid[(size_t)(h / 2) * w + w / 2] = 'P';
+
+    static const char items[] = { COIN, COIN, BATTERY_PACK, OXYGEN_TANK };
+    for (int placed = 0; placed < spec.enemies + spec.collectibles; ) {
+        char& tile = grid[(size_t)(1 + rand() % (h - 2)) * w + 1 + rand() % (w - 2)];
+        if (tile != 'o') continue;
+        tile = placed < spec.enemies ? 'M' : items[rand() % 4];
+        placed++;
+    }
+
+    ofstream out(path);
+    for (int y = 0; y < h; y++) out << grid.substr((size_t)y * w, w) << '\n';
+    return path;
+}
+
+// Converts the text map for the same spec into the binary format
+string write_binary_map_file(const MapSpec& spec) {
+    string path = "/tmp/holy_diver_bench_map.hdm";
+    World world;
+    string error;
+    world.loadMap(write_map_file(spec), error);
+    world.saveBinaryMap(path, error);
+    return path;
+}
+
+struct LoadMapCase : Case {
+    string path;
+    LoadMapCase(const MapSpec& spec, bool binary)
+        : path(binary ? write_binary_map_file(spec) : write_map_file(spec)) {}
+    void run() {
+        World world;
+        string error;
+        world.loadMap(path, error);
+        sink += world.getWidth();
+    }
+};
+
+// A bundled level, next to its text twin written out to a file
+struct LoadLevelCase : Case {
+    string path;
+    LoadLevelCase(const EmbeddedLevel& level, bool embedded) {
+        if (embedded) {
+            path = string("level:") + level.name;
+            return;
+        }
+        path = "/tmp/holy_diver_bench_level.txt";
+        ofstream out(path.c_str());
+        for (int y = 0; y < level.height; y++) out << level.rows + y * (level.width + 1) << "\n";
+    }
+    void run() {
+        World world;
+        string error;
+        world.loadMap(path, error);
+        sink += world.getWidth();
+    }
+};
+
+// Restores the post-load snapshot after some play, as the R key does
+struct ResetCase : Case {
+    MapSpec spec;
+    World* world;
+    explicit ResetCase(const MapSpec& s) : spec(s), world(nullptr) {}
+    ~ResetCase() { delete world; }
+    void setUp() { world = make_world(spec, true); }
+    void run() {
+        world->updateEnemies();
+        world->reset();
+        sink += world->getScore();
+    }
+};
+
+struct DefaultMapCase : Case {
+    void run() {
+        World world;
+        world.createDefaultMap();
+        sink += world.getScore();
+    }
+};
+
+struct WorldCase : Case {
+    MapSpec spec;
+    bool alerted;
+    World* world;
+    WorldCase(const MapSpec& s, bool alert) : spec(s), alerted(alert), world(nullptr) {}
+    ~WorldCase() { delete world; }
+    void setUp() { world = make_world(spec, alerted); }
+};
+
+// Swims back and forth next to the start tile
+struct RequestMoveCase : WorldCase {
+    int step;
+    explicit RequestMoveCase(const MapSpec& s) : WorldCase(s, false), step(0) {}
+    void run() {
+        Player* p = world->getPlayer();
+        int dx = (step++ & 1) ? -1 : 1;
+        sink += world->requestMove(p->getX(), p->getY(), p->getX() + dx, p->getY(), true);
+        p->addOxygen(2);
+    }
+};
+
+struct IlluminateCase : WorldCase {
+    int step;
+    explicit IlluminateCase(const MapSpec& s) : WorldCase(s, false), step(0) {}
+    void run() {
+        Player* p = world->getPlayer();
+        static const int dx[] = { 0, 1, 0, -1 };
+        static const int dy[] = { -1, 0, 1, 0 };
+        int dir = step++ & 3;
+        world->illuminateTile(p->getX() + dx[dir], p->getY() + dy[dir]);
+        p->rechargeBattery(BATTERY_COST);
+    }
+};
+
+// Optionally spreads the proposals over one thread per core
+struct UpdateEnemiesCase : WorldCase {
+    WorkerPool pool;
+    UpdateEnemiesCase(const MapSpec& s, bool alert, bool parallel)
+        : WorldCase(s, alert), pool(parallel ? max(1u, thread::hardware_concurrency()) - 1 : 0) {}
+    void setUp() {
+        WorldCase::setUp();
+        world->setWorkers(&pool);
+    }
+    void run() {
+        world->updateEnemies();
+        sink += world->getPlayer()->getHealth();
+    }
+};
+
+// The diver swims every tick, so the chase field is rebuilt each time
+struct ChaseCase : WorldCase {
+    int step;
+    explicit ChaseCase(const MapSpec& s) : WorldCase(s, true), step(0) {}
+    void run() {
+        Player* p = world->getPlayer();
+        int dx = (step++ & 1) ? -1 : 1;
+        world->requestMove(p->getX(), p->getY(), p->getX() + dx, p->getY(), true);
+        p->addOxygen(2);
+        world->updateEnemies();
+        sink += p->getHealth();
+    }
+};
+
+// Moves the diver back and forth so every operation casts the field of
+// view again, or stays put and asks about the tiles around them
+struct FovCase : WorldCase {
+    bool moving;
+    int step;
+    FovCase(const MapSpec& s, bool move) : WorldCase(s, false), moving(move), step(0) {}
+    void run() {
+        Player* p = world->getPlayer();
+        if (moving) {
+            int dx = (step & 1) ? -1 : 1;
+            world->requestMove(p->getX(), p->getY(), p->getX() + dx, p->getY(), true);
+            p->addOxygen(2);
+        }
+        step++;
+        sink += world->canSee(p->getX() + (step & 7) - 4, p->getY() + ((step >> 3) & 7) - 4);
+    }
+};
+
+// One autopilot decision: the window copy plus a full beam search
+struct AutopilotCase : WorldCase {
+    Autopilot pilot;
+    explicit AutopilotCase(const MapSpec& s) : WorldCase(s, false) {}
+    void run() { sink += pilot.choose(*world); }
+};
+
+// Plays back a recorded explore session from the post-load snapshot
+struct ReplayCase : WorldCase {
+    SessionLog log;
+    explicit ReplayCase(const MapSpec& s) : WorldCase(s, false) {}
+    void restart() {
+        world->seed(12345);
+        world->reset();
+    }
+    void setUp() {
+        WorldCase::setUp();
+        restart();
+        log.begin("", "", 0, 12345, world->levelHash());
+        run_headless(world, POLICY_EXPLORE, "", 500, 12345, &log);
+    }
+    void run() {
+        restart();
+        sink += run_replay(world, log, [](const World&) {}).score;
+    }
+};
+
+// Renders into an in-memory screen; full redraws force every cell out
+struct RenderCase : WorldCase {
+    Screen screen;
+    bool full;
+    RenderCase(const MapSpec& s, bool fullRedraw) : WorldCase(s, true), full(fullRedraw) {}
+    void setUp() {
+        WorldCase::setUp();
+        // Light the whole viewport so every cell does real work
+        Player* p = world->getPlayer();
+        for (int y = p->getY() - VIEW_HEIGHT; y <= p->getY() + VIEW_HEIGHT; y++) {
+            for (int x = p->getX() - VIEW_WIDTH; x <= p->getX() + VIEW_WIDTH; x++) {
+                world->illuminateTile(x, y);
+                p->rechargeBattery(BATTERY_COST);
+            }
+        }
+    }
+    void run() {
+        if (full) screen.invalidate();
+        world->render(screen);
+        sink += screen.compose().size();
+    }
+};
+
+// Sight-range and collision scans over packed coordinates clustered around
+// the diver, through the vector kernels or their scalar reference
+struct EnemyScanCase : Case {
+    bool vectorised;
+    vector<int> xs, ys, damage, nearby;
+    EnemyScanCase(int n, bool simd) : vectorised(simd), xs(n), ys(n), damage(n), nearby(n) {
+        srand(12345);
+        for (int i = 0; i < n; i++) {
+            xs[i] = 500 + rand() % 64;
+            ys[i] = 500 + rand() % 64;
+            damage[i] = ENEMY_DAMAGE[i & 1];
+        }
+    }
+    void run() {
+        int n = xs.size();
+        if (vectorised) {
+            sink += find_nearby(xs.data(), ys.data(), n, 530, 530, SIGHT_RANGE, nearby.data());
+            sink += collision_damage(xs.data(), ys.data(), damage.data(), n, 530, 530);
+        } else {
+            sink += find_nearby_scalar(xs.data(), ys.data(), n, 530, 530, SIGHT_RANGE, nearby.data());
+            sink += collision_damage_scalar(xs.data(), ys.data(), damage.data(), n, 530, 530);
+        }
+    }
+};
+
+// The vector kernels must agree exactly with the scalar ones, including
+// the tails and coordinates far outside the map
+bool verify_enemy_kernels() {
+    srand(777);
+    for (int trial = 0; trial < 2000; trial++) {
+        int n = rand() % 70;
+        int spread = trial % 3 == 0 ? 2000000000 : 12;
+        vector<int> xs(n), ys(n), damage(n), a(n + 1), b(n + 1);
+        for (int i = 0; i < n; i++) {
+            xs[i] = rand() % spread - spread / 2;
+            ys[i] = rand() % spread - spread / 2;
+            damage[i] = rand() % 50;
+        }
+        int px = rand() % 12 - 6, py = rand() % 12 - 6, range = rand() % 5;
+        int na = find_nearby(xs.data(), ys.data(), n, px, py, range, a.data());
+        int nb = find_nearby_scalar(xs.data(), ys.data(), n, px, py, range, b.data());
+        if (na != nb || !equal(a.begin(), a.begin() + na, b.begin()) ||
+            collision_damage(xs.data(), ys.data(), damage.data(), n, px, py) !=
+                collision_damage_scalar(xs.data(), ys.data(), damage.data(), n, px, py)) {
+            printf("enemy scan kernels disagree with the scalar path (trial %d)\n", trial);
+            return false;
+        }
+    }
+    return true;
+}
+
+/****************************************************/
+// Benchmark entry point
+/****************************************************/
+int main(int argc, char** argv) {
+    if (argc > 1) name_filter = argv[1];
+    if (!verify_enemy_kernels()) return 1;
+
+    static const MapSpec specs[] = {
+        { 20, 20, 15, 20 },
+        { 256, 256, 1024, 1024 },
+        { 4096, 4096, 65536, 65536 },
+    };
+    const int specCount = sizeof(specs) / sizeof(specs[0]);
+
+    { DefaultMapCase c; report("createDefaultMap", c); }
+    { LoadLevelCase c(BUNDLED_LEVELS[0], true); report("loadMap/level/embedded", c); }
+    { LoadLevelCase c(BUNDLED_LEVELS[0], false); report("loadMap/level/text", c); }
+    for (int i = 0; i < specCount; i++) {
+        const MapSpec& spec = specs[i];
+        if (name_filter.empty() || spec_name("loadMap/text", spec).find(name_filter) != string::npos) {
+            LoadMapCase c(spec, false);
+            report(spec_name("loadMap/text", spec), c);
+        }
+        if (name_filter.empty() || spec_name("loadMap/binary", spec).find(name_filter) != string::npos) {
+            LoadMapCase c(spec, true);
+            report(spec_name("loadMap/binary", spec), c);
+        }
+        { ResetCase c(spec); report(spec_name("reset", spec), c); }
+        { RequestMoveCase c(spec); report(spec_name("requestMove", spec), c); }
+        { IlluminateCase c(spec); report(spec_name("illuminateTile", spec), c); }
+        { UpdateEnemiesCase c(spec, false, false); report(spec_name("updateEnemies/dormant", spec), c); }
+        { UpdateEnemiesCase c(spec, true, false); report(spec_name("updateEnemies/alerted", spec), c); }
+        { UpdateEnemiesCase c(spec, true, true); report(spec_name("updateEnemies/parallel", spec), c); }
+        { ChaseCase c(spec); report(spec_name("updateEnemies/chasing", spec), c); }
+        { FovCase c(spec, true); report(spec_name("fov/compute", spec), c); }
+        { FovCase c(spec, false); report(spec_name("fov/query", spec), c); }
+        { AutopilotCase c(spec); report(spec_name("autopilot/choose", spec), c); }
+        { ReplayCase c(spec); report(spec_name("replay/explore", spec), c); }
+        { RenderCase c(spec, false); report(spec_name("render/diff", spec), c); }
+        { RenderCase c(spec, true); report(spec_name("render/full", spec), c); }
+    }
+    static const int scanSizes[] = { 1024, 100000 };
+    for (int i = 0; i < 2; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "enemyScan/simd/n%d", scanSizes[i]);
+        { EnemyScanCase c(scanSizes[i], true); report(name, c); }
+        snprintf(name, sizeof(name), "enemyScan/scalar/n%d", scanSizes[i]);
+        { EnemyScanCase c(scanSizes[i], false); report(name, c); }
+    }
+    return 0;
+}